@@ -0,0 +1,48 @@
+#ifndef _AIO_H
+#define _AIO_H
+
+#include <include/types.h>
+#include <include/list.h>
+#include <include/vfs.h>
+
+#define AIO_MAX_NR 32            /* iocbs a task may have submitted, unreaped */
+#define AIO_MAX_BYTES (1 << 16)  /* largest transfer of one iocb */
+
+enum { IOCB_CMD_PREAD, IOCB_CMD_PWRITE };
+
+/* asynchronous request of a user task */
+struct iocb {
+    uint64_t aio_data;  // returned in io_event.data
+    int32_t aio_fildes;
+    int32_t aio_lio_opcode;  // IOCB_CMD_*
+    void *aio_buf;
+    size_t aio_nbytes;
+    size_t aio_offset;  // file position, the file offset is left untouched
+};
+
+struct io_event {
+    uint64_t data;  // aio_data of the iocb
+    int64_t res;    // bytes transferred or -1
+};
+
+struct task_struct;
+
+/* in-kernel copy of an iocb */
+struct kiocb {
+    struct iocb ki_iocb;
+    struct task_struct *ki_task;  // submitter
+    file_t ki_file;               // private readahead state of the request
+    void *ki_buf;                 // kernel buffer of the transfer
+    int64_t ki_res;
+    struct list_head ki_node;  // aio_queue, then the submitter's aio_done
+};
+
+void aio_init();
+void kaiod();
+void exit_aio(struct task_struct *task);
+
+/* for syscall */
+int32_t do_io_submit(struct iocb *iocbs, int32_t nr);
+int32_t do_io_getevents(int32_t min_nr, int32_t nr, struct io_event *events);
+
+#endif
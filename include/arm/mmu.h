@@ -14,6 +14,7 @@
 
 /* Page descriptor */
 #define PD_TABLE 0b11
+#define PD_TABLE_RDONLY (1ULL << 62)  // APTable[1]: no write below the table
 #define PD_BLOCK 0b01
 #define PD_PAGE 0b11
 #define PD_ACCESS (1 << 10)
@@ -22,6 +23,7 @@
 #define PD_ACCESS_PERM_2 (0b10 << 6)  // EL0: NA, EL1: RO
 #define PD_ACCESS_PERM_3 (0b11 << 6)  // EL0: RO, EL1: RO
 #define PD_ACCESS_EXEC (1ULL << 54)
+#define PTE_COW (1ULL << 55)  // software bit: read-only until written, shared
 #define PD_MASK 0x1ffULL
 #define PTE_ADDR_MASK \
     ((pteval_t) ((1ull << (48 - PAGE_SHIFT)) - 1) << PAGE_SHIFT)
@@ -31,6 +33,7 @@
 #define PUD1_ATTR (PD_ACCESS | (MAIR_IDX_DEVICE_nGnRnE << 2) | PD_BLOCK)
 #define PMD0_ATTR PD_TABLE
 #define PTE_NORMAL_ATTR (PD_ACCESS | (MAIR_IDX_NORMAL_NOCACHE << 2) | PD_PAGE)
+#define PMD_NORMAL_ATTR (PD_ACCESS | (MAIR_IDX_NORMAL_NOCACHE << 2) | PD_BLOCK)
 #define PTE_DEVICE_ATTR (PD_ACCESS | (MAIR_IDX_DEVICE_nGnRnE << 2) | PD_PAGE)
 
 #define PGD_SHIFT 39
@@ -26,6 +26,7 @@
 #define SPSR_EL2h (0b1001)
 #define SPSR_EL1_MASK_NONE (0 << 6)
 #define SPSR_EL2_MASK_ALL (7 << 6)
+#define SPSR_NZCV 0xf0000000  // condition flags, the part EL0 may choose
 #define SPSR_EL1_VALUE (SPSR_EL1_MASK_NONE | SPSR_EL0t)
 #define SPSR_EL2_VALUE (SPSR_EL2_MASK_ALL | SPSR_EL1h)
 
@@ -37,4 +38,8 @@
 #define CPACR_EL1_FPEN (0b11 << 20)
 #define CPACR_EL1_VALUE (CPACR_EL1_FPEN)
 
+// Counter-timer Kernel Control Register
+#define CNTKCTL_EL1_EL0PCTEN (1 << 0)  // EL0 reads the physical counter
+#define CNTKCTL_EL1_VALUE (CNTKCTL_EL1_EL0PCTEN)
+
 #endif
@@ -0,0 +1,59 @@
+#ifndef _BLKDEV_H
+#define _BLKDEV_H
+
+#include <include/types.h>
+#include <include/list.h>
+
+#define BLK_SECTOR_SIZE 512
+#define BLK_MAX_SECTORS 128  /* sectors moved by one command */
+#define BLK_NR_REQUESTS 32   /* requests queued before the queue is run */
+
+enum req_op { REQ_READ, REQ_WRITE };
+
+struct bio;
+typedef void (*bio_end_io_t)(struct bio *bio);
+
+/* sectors transferred from or to one buffer */
+struct bio {
+    enum req_op bi_op;
+    uint32_t bi_sector;
+    uint32_t bi_count;
+    void *bi_buf;
+    bool bi_done;
+    int bi_error;              // zero or negative error number once done
+    bio_end_io_t bi_end_io;    // completion callback, IRQ masked, or NULL
+    void *bi_private;          // owned by the submitter of the bio
+    struct list_head bi_node;  // bios of a request, in sector order
+};
+
+/* adjacent bios served by one SD command */
+struct request {
+    enum req_op op;
+    uint32_t sector;
+    uint32_t count;
+    struct list_head bios;
+    struct list_head queuelist;  // queued requests, in sector order
+};
+
+/* counters of the SD card, indexed by enum req_op */
+struct blk_stats {
+    uint64_t ios[2];      // commands issued
+    uint64_t merges[2];   // bios merged into a queued request
+    uint64_t sectors[2];  // sectors transferred
+    uint64_t ticks[2];    // counter ticks spent in the driver
+};
+
+void blk_init();
+void bio_init(struct bio *bio,
+              enum req_op op,
+              uint32_t sector,
+              uint32_t count,
+              void *buf);
+void blk_submit_bio(struct bio *bio);
+void blk_run_queue();
+int blk_wait_bio(struct bio *bio);
+int blk_rw(enum req_op op, uint32_t sector, uint32_t count, void *buf);
+int64_t do_iostat(struct blk_stats *stats);
+void kblockd();
+
+#endif
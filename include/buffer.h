@@ -0,0 +1,39 @@
+#ifndef _BUFFER_H
+#define _BUFFER_H
+
+#include <include/types.h>
+#include <include/list.h>
+#include <include/blkdev.h>
+
+#define NR_BUFFERS 256       /* cached blocks before clean ones are recycled */
+#define BH_HASH_SIZE 64      /* number of hash chains */
+#define BDFLUSH_INTERVAL 5   /* seconds a block may stay dirty in memory */
+
+enum bh_state {
+    BH_UPTODATE = 1 << 0,  // b_data holds the block content
+    BH_DIRTY = 1 << 1,     // b_data is newer than the block on the card
+};
+
+struct buffer_head {
+    uint32_t b_blocknr;
+    uint32_t b_state;
+    uint32_t b_count;          // users holding the buffer
+    uint64_t b_dirtied;        // counter value when it became dirty
+    uint8_t *b_data;           // SECTOR_SIZE bytes
+    struct list_head b_hash;   // hash chain
+    struct list_head b_lru;    // least recently used first
+    struct list_head b_dirty;  // dirty buffers, oldest first
+    struct list_head b_io;     // buffers being written back
+    struct bio b_bio;
+};
+
+void buffer_init();
+struct buffer_head *getblk(uint32_t blocknr);
+struct buffer_head *bread(uint32_t blocknr);
+void brelse(struct buffer_head *bh);
+void mark_buffer_dirty(struct buffer_head *bh);
+void buffer_copy_cached(uint32_t blocknr, uint32_t count, void *buf);
+int sync_blockdev();
+void bdflush();
+
+#endif
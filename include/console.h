@@ -0,0 +1,8 @@
+#ifndef _CONSOLE_H
+#define _CONSOLE_H
+
+#define CONSOLE_PATH "/dev/console"
+
+void console_init();
+
+#endif
@@ -16,6 +16,7 @@ enum {
     E_EOF = 8,           // Unexpected end of file
     E_RESTARTSYS = 9,    // Restart system call
     E_BUSY = 10,
+    E_IO = 11,  // Device I/O failed
 };
 
 #endif
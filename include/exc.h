@@ -10,6 +10,7 @@
 #define ESR_ELx_EC_SVC64 0x15
 #define ESR_ELx_EC_INST_ABORT_LOW 0x20
 #define ESR_ELx_EC_DATA_ABORT_LOW 0x24
+#define ESR_ELx_EC_DATA_ABORT_CUR 0x25
 
 struct TrapFrame {
     uint64_t x[31];  // x0-x30
@@ -18,6 +19,7 @@ struct TrapFrame {
 
 void show_invalid_entry_message(struct TrapFrame *);
 void sync_handler(struct TrapFrame *);
+void el1_sync_handler(struct TrapFrame *);
 void svc_handler(struct TrapFrame *);
 
 #endif
\ No newline at end of file
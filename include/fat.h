@@ -10,6 +10,12 @@
 #define LFN_MARK 0x0F
 #define FAT_LAST (-1)
 #define SECTOR_SIZE 512
+#define FAT_EOC 0x0FFFFFF8  // end of cluster chain
+#define FAT_SCAN_BLOCKS 8   // FAT sectors read at once when scanning
+#define FSINFO_LEAD_SIG 0x41615252
+#define FSINFO_SIG 0x61417272
+#define FSINFO_TRAIL_SIG 0xAA550000
+#define FSINFO_UNKNOWN 0xFFFFFFFF
 
 enum sfn_desc {
     NOT_IN_USE = 0x00,
@@ -135,11 +141,14 @@ struct fat_entry {
 };
 
 extern uint32_t bytesPerSector, sectorsPerCluster, bytesPerCluster, fatStart,
-    rootCluster, dataStart;
+    rootCluster, dataStart, clusterCount, fsInfoAddress;
 uint32_t clusterAddress(uint32_t cluster, bool isRoot);
 unsigned int nextCluster(unsigned int cluster);
-void readData(uint32_t address, char *buffer, int size);
-void writeData(uint32_t address, char *buffer, int size);
+int readData(uint32_t address, char *buffer, int size);
+int writeData(uint32_t address, char *buffer, int size);
+void fat_load_fsinfo();
+void fat_sync_fsinfo();
+int fat_alloc_clusters(uint32_t prev, uint32_t want, uint32_t *first);
 void get_entries(uint8_t *cluster, uint32_t size, struct list_head *head);
 char *get_entry_short_filename(struct fat_entry entry);
 
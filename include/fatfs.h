@@ -3,12 +3,25 @@
 
 #include <include/types.h>
 #include <include/vfs.h>
+#include <include/pagecache.h>
 
 #define FATFS_FIEL_BUFFER_MAX_LEN 64
+#define FATFS_INIT_EXTENTS 4
+
+/* clusters [file_cluster, file_cluster + len) of a file from disk_cluster on */
+struct fat_extent {
+    uint32_t file_cluster;
+    uint32_t disk_cluster;
+    uint32_t len;
+};
 
 typedef struct fatfs_node {
     struct inode inode;
     uint32_t cluster;
+    struct address_space mapping;
+    struct fat_extent *extents;  // mapped part of the cluster chain
+    uint32_t nr_extents, max_extents;
+    uint32_t cursor;  // extent hit by the last lookup
 } fatfs_node_t;
 
 void fatfs_init();
@@ -0,0 +1,20 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <include/types.h>
+#include <include/list.h>
+#include <include/mm.h>
+#include <include/pagecache.h>
+
+/* ELF image in kernel memory, pages of it shared by the tasks executing it */
+struct exec_image {
+    kernaddr_t start;
+    size_t size;  // bytes mapped from the image, pages are zero past them
+    struct address_space mapping;  // file page index -> copy of the page
+    struct list_head list;
+};
+
+struct exec_image *get_exec_image(kernaddr_t start, size_t size);
+page_t *image_get_page(struct exec_image *image, uint64_t index);
+
+#endif
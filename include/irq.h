@@ -1,8 +1,14 @@
 #ifndef IRQ_H
 #define IRQ_H
 
+#include <include/types.h>
+
+#define DAIF_IRQ_BIT (1 << 7)  // IRQ is masked if set
+
 void enable_irq();
 void disable_irq();
+uint64_t irq_save();
+void irq_restore(uint64_t daif);
 void irq_handler();
 
 #endif
\ No newline at end of file
@@ -8,8 +8,13 @@
 #define PAGE_SIZE (1UL << PAGE_SHIFT)
 #define PAGE_MASK (~(PAGE_SIZE - 1))
 #define PAGE_NUM (0x40000000 / PAGE_SIZE)
+#define HPAGE_SHIFT 21  // huge page mapped by one PMD block
+#define HPAGE_SIZE (1UL << HPAGE_SHIFT)
+#define HPAGE_ORDER (HPAGE_SHIFT - PAGE_SHIFT)
 #define KERNEL_STACK_SIZE (PAGE_TABLE_SIZE << 1)  // 8KB
 #define USER_VIRT_TOP 0x0000ffffffffe000ULL
+#define EXEC_STACK_BASE (USER_VIRT_TOP - PAGE_SIZE)  // argv and envp of exec
+#define USER_VIRT_LIMIT (1ULL << 48)  // end of the range VMAs are placed in
 #define VMA_NUM 4096
 
 #ifndef __ASSEMBLER__
@@ -17,18 +22,33 @@
 #include <include/types.h>
 #include <include/list.h>
 #include <include/pgtable-types.h>
-#include <include/btree.h>
+#include <include/vmatree.h>
+
+struct address_space;
+struct file;
+struct exec_image;
 
 #define KVA_TO_PA(addr) ((uint64_t) (addr) << 16 >> 16)
 #define PA_TO_KVA(addr) ((uint64_t) (addr) | KERNEL_VIRT_BASE)
 #define PA_TO_PFN(addr) ((uint64_t) (addr) >> PAGE_SHIFT)
 #define PFN_TO_PA(idx) ((uint64_t) (idx) << PAGE_SHIFT)
 
-enum page_flag { PAGE_USED = 1 << 0 };
+enum page_flag {
+    PAGE_USED = 1 << 0,
+    PAGE_UPTODATE = 1 << 1,
+    PAGE_DIRTY = 1 << 2,  // written through a shared mapping, not written back
+};
+
+enum vm_flag {
+    VM_SHARED = 1 << 0,      // writes reach vm_file or a kernel page, no COW
+    VM_NOHUGEPAGE = 1 << 1,  // never mapped by huge pages
+};
 
 typedef struct {
     pgd_t *pgd;
-    btree mm_bt;
+    struct vma_tree mm_vt;
+    virtaddr_t start_brk;  // start of the heap, set by exec
+    virtaddr_t brk;        // current program break
 } mm_struct;
 
 typedef struct {
@@ -36,16 +56,46 @@ typedef struct {
     uint32_t refcnt;
     uint8_t order;
     struct slab *page_slab;
+    uint32_t flags;                 // enum page_flag
+    struct address_space *mapping;  // owner in page cache
+    uint64_t index;                 // page offset in mapping
 } page_t;
 
 struct vm_area_struct {
     virtaddr_t vm_start;
-    virtaddr_t vm_end;
+    virtaddr_t vm_end;  // page aligned
     mm_struct *vm_mm;
     pgprot_t vm_page_prot;
     kernaddr_t vm_file_start;
     off_t vm_file_offset;
     size_t vm_file_len;
+    struct file *vm_file;  // private copy of the mapped file, or NULL
+    uint64_t vm_pgoff;     // page of vm_file mapped at vm_start
+    uint32_t vm_flags;     // enum vm_flag
+
+    // pages of a read-only ELF segment, shared with other tasks, or NULL
+    struct exec_image *vm_image;
+
+    // node of the VMA tree of vm_mm
+    struct vm_area_struct *vm_left, *vm_right, *vm_parent;
+    int32_t vm_height;
+    uint64_t vm_gap;           // free bytes between the previous VMA and this
+    uint64_t vm_max_gap;       // largest vm_gap of the subtree
+    struct list_head vm_list;  // VMAs of vm_mm in address order
+};
+
+/*
+ * Callbacks of walk_page_range(). pmd_entry, which may be NULL, returns
+ * whether it dealt with the entry, or the PTEs below it are walked.
+ */
+struct mm_walk {
+    mm_struct *mm;
+    bool (*pmd_entry)(pmd_t *pmd, virtaddr_t addr, struct mm_walk *walk);
+    void (*pte_range)(pte_t *ptep,
+                      virtaddr_t addr,
+                      size_t nr,
+                      struct mm_walk *walk);
+    void *private;
 };
 
 void mem_init();
@@ -54,11 +104,19 @@ page_t *buddy_alloc(uint8_t);
 void buddy_free(page_t *);
 void page_init();
 page_t *page_alloc();
+void page_decref(page_t *);
 void unmap_page(mm_struct *mm, virtaddr_t addr);
 physaddr_t page2pa(page_t *);
 page_t *pa2page(physaddr_t);
 int32_t follow_pte(mm_struct *mm, virtaddr_t address, pte_t **ptepp);
+void set_page_pte(pte_t *, page_t *, pgprot_t);
 int32_t insert_page(mm_struct *, page_t *, virtaddr_t, pgprot_t);
+page_t *huge_page_alloc();
+int32_t insert_huge_page(mm_struct *, page_t *, virtaddr_t, pgprot_t);
+pmd_t *follow_huge_pmd(mm_struct *mm, virtaddr_t address);
+bool pmd_unused(mm_struct *mm, virtaddr_t address);
+int32_t walk_page_range(virtaddr_t start, virtaddr_t end, struct mm_walk *walk);
+int32_t unmap_page_range(mm_struct *mm, virtaddr_t start, virtaddr_t end);
 void mm_init(mm_struct *);
 void mm_destroy(mm_struct *);
 void copy_mm(mm_struct *dst, const mm_struct *src);
@@ -2,6 +2,8 @@
 #define _MMAN_H
 
 #include <include/types.h>
+#include <include/mm.h>
+#include <include/vfs.h>
 
 typedef enum {
     PROT_NONE = 0x0,
@@ -11,6 +13,8 @@ typedef enum {
 } mmap_prot_t;
 
 typedef enum {
+    MAP_SHARED = 0x01,
+    MAP_PRIVATE = 0x02,
     MAP_FIXED = 0x10,
     MAP_ANONYMOUS = 0x20,
     MAP_POPULATE = 0x008000
@@ -18,11 +22,45 @@ typedef enum {
 
 #define MAP_FAILED ((void *) -1)
 
+#define FAULT_AROUND_PAGES 16  /* pages mapped around a fault without I/O */
+
+/* msync flags, the write back is always synchronous */
+enum { MS_ASYNC = 0x1, MS_INVALIDATE = 0x2, MS_SYNC = 0x4 };
+
+/* madvise advices, only the huge page ones are supported */
+enum { MADV_HUGEPAGE = 14, MADV_NOHUGEPAGE = 15 };
+
 void *do_mmap(void *addr,
               size_t len,
               mmap_prot_t prot,
               mmap_flags_t flags,
               void *file_start,
               off_t file_offset);
+void *do_mmap_image(void *addr,
+                    size_t len,
+                    mmap_prot_t prot,
+                    void *bin_start,
+                    off_t offset,
+                    size_t filesz);
+void *do_mmap_file(void *addr,
+                   size_t len,
+                   mmap_prot_t prot,
+                   mmap_flags_t flags,
+                   file_t *file,
+                   off_t offset);
+void *do_mmap_kernel_page(page_t *pp, mmap_prot_t prot);
+int32_t filemap_fault(mm_struct *mm,
+                      struct vm_area_struct *vma,
+                      virtaddr_t va,
+                      bool write);
+int32_t handle_mm_fault(mm_struct *mm,
+                        struct vm_area_struct *vma,
+                        virtaddr_t va,
+                        bool write);
+int32_t do_msync(void *addr, size_t len, int32_t flags);
+int32_t do_munmap(void *addr, size_t len);
+int32_t do_mprotect(void *addr, size_t len, mmap_prot_t prot);
+int32_t do_madvise(void *addr, size_t len, int32_t advice);
+virtaddr_t do_brk(virtaddr_t addr);
 
 #endif
\ No newline at end of file
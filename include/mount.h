@@ -8,9 +8,19 @@ struct vfsmount {
     struct super_block *mnt_sb;  // superblock of file system
 };
 
+struct super_block;
+
+struct super_operations {
+    /* write back in-memory filesystem state before the blocks are flushed */
+    int (*sync_fs)(struct super_block *sb);
+    int (*statfs)(struct super_block *sb, struct statfs *buf);
+};
+
 struct super_block {
     struct dentry *s_root;      // dentry for root directory
     struct list_head s_mounts;  // list of mount
+    const struct super_operations *s_op;
+    void *s_fs_info;  // filesystem private data
 };
 
 struct mount {
@@ -0,0 +1,58 @@
+#ifndef _PAGECACHE_H
+#define _PAGECACHE_H
+
+#include <include/types.h>
+#include <include/mm.h>
+#include <include/radix_tree.h>
+#include <include/vfs.h>
+
+/* readahead window, in pages */
+#define RA_INIT_PAGES 4
+#define RA_MAX_PAGES 32
+
+struct address_space;
+
+struct address_space_operations {
+    /* fill `nr_pages` pages starting from `index` into the page cache */
+    int (*readpages)(struct address_space *mapping,
+                     uint64_t index,
+                     uint32_t nr_pages);
+    /* write a dirty page back to the backing store, NULL if there is none */
+    int (*writepage)(struct address_space *mapping, page_t *pp);
+};
+
+struct address_space {
+    struct radix_tree_root page_tree;  // page index -> page_t
+    size_t nrpages;
+    struct inode *host;
+    const struct address_space_operations *a_ops;
+};
+
+static inline void *page_address(page_t *pp)
+{
+    return (void *) PA_TO_KVA(page2pa(pp));
+}
+
+void address_space_init(struct address_space *mapping,
+                        struct inode *host,
+                        const struct address_space_operations *a_ops);
+page_t *find_get_page(struct address_space *mapping, uint64_t index);
+page_t *add_to_page_cache(struct address_space *mapping, uint64_t index);
+page_t *grab_cache_page(struct address_space *mapping, uint64_t index);
+void remove_from_page_cache(page_t *pp);
+void truncate_inode_pages(struct address_space *mapping, uint64_t start);
+void invalidate_mapping_pages(struct address_space *mapping);
+int filemap_fdatawrite(struct address_space *mapping);
+page_t *read_cache_page(struct address_space *mapping,
+                        struct file_ra_state *ra,
+                        uint64_t index);
+ssize_t generic_file_read(file_t *file,
+                          void *buf,
+                          size_t len,
+                          size_t *ppos);
+void pagecache_update(struct address_space *mapping,
+                      size_t pos,
+                      const void *buf,
+                      size_t len);
+
+#endif
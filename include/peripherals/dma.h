@@ -0,0 +1,56 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include <include/peripherals/base.h>
+#include <include/types.h>
+
+// https://datasheets.raspberrypi.com/bcm2835/bcm2835-peripherals.pdf, ch.4
+#define DMA_BASE (MMIO_BASE + 0x00007000)
+#define DMA_CS(ch) ((volatile unsigned int *) (DMA_BASE + (ch) * 0x100))
+#define DMA_CONBLK_AD(ch) \
+    ((volatile unsigned int *) (DMA_BASE + (ch) * 0x100 + 0x04))
+#define DMA_DEBUG(ch) \
+    ((volatile unsigned int *) (DMA_BASE + (ch) * 0x100 + 0x20))
+#define DMA_INT_STATUS ((volatile unsigned int *) (DMA_BASE + 0xFE0))
+#define DMA_ENABLE ((volatile unsigned int *) (DMA_BASE + 0xFF0))
+
+#define DMA_CS_ACTIVE (1 << 0)
+#define DMA_CS_END (1 << 1)
+#define DMA_CS_INT (1 << 2)
+#define DMA_CS_ERROR (1 << 8)
+#define DMA_CS_PRIORITY(x) ((x) << 16)
+#define DMA_CS_PANIC_PRIORITY(x) ((x) << 20)
+#define DMA_CS_WAIT_OUTSTANDING_WRITES (1 << 28)
+#define DMA_CS_ABORT (1 << 30)
+#define DMA_CS_RESET (1U << 31)
+
+#define DMA_TI_INTEN (1 << 0)
+#define DMA_TI_WAIT_RESP (1 << 3)
+#define DMA_TI_DEST_INC (1 << 4)
+#define DMA_TI_DEST_DREQ (1 << 6)
+#define DMA_TI_SRC_INC (1 << 8)
+#define DMA_TI_SRC_DREQ (1 << 10)
+#define DMA_TI_PERMAP(x) ((x) << 16)
+
+#define DMA_DEBUG_CLEAR 0x7  // read last not set, FIFO and read errors
+
+#define DMA_DREQ_SDHOST 13
+#define DMA_IRQ(ch) (1 << (16 + (ch)))  // in IRQ_PENDING_1
+
+// addresses seen by the DMA engine
+#define BUS_PERIPHERAL_BASE 0x7E000000
+#define BUS_MEMORY_ALIAS 0xC0000000  // L2 uncached alias of SDRAM
+#define PA_TO_BUS(pa) ((uint32_t) (pa) | BUS_MEMORY_ALIAS)
+
+/* control block, must be 32 bytes aligned */
+struct dma_cb {
+    uint32_t ti;
+    uint32_t source_ad;
+    uint32_t dest_ad;
+    uint32_t txfr_len;
+    uint32_t stride;
+    uint32_t nextconbk;
+    uint32_t reserved[2];
+} __attribute__((aligned(32)));
+
+#endif
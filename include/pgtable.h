@@ -21,6 +21,8 @@ static inline pte_t pgd_pte(pgd_t pgd)
     return __pte(pgd_val(pgd));
 }
 
+#define pmd_huge(pmd) ((pmd_val(pmd) & 0b11) == PD_BLOCK)
+
 #define __pte_to_phys(pte) ((physaddr_t) (pte_val(pte) & PTE_ADDR_MASK))
 #define __pmd_to_phys(pmd) __pte_to_phys(pmd_pte(pmd))
 #define __pud_to_phys(pud) __pte_to_phys(pud_pte(pud))
@@ -0,0 +1,36 @@
+#ifndef _RADIX_TREE_H
+#define _RADIX_TREE_H
+
+#include <include/types.h>
+
+#define RADIX_TREE_MAP_SHIFT 6
+#define RADIX_TREE_MAP_SIZE (1UL << RADIX_TREE_MAP_SHIFT)
+#define RADIX_TREE_MAP_MASK (RADIX_TREE_MAP_SIZE - 1)
+#define RADIX_TREE_MAX_HEIGHT \
+    ((64 + RADIX_TREE_MAP_SHIFT - 1) / RADIX_TREE_MAP_SHIFT)
+
+struct radix_tree_node {
+    uint32_t count; /* number of non-empty slots */
+    void *slots[RADIX_TREE_MAP_SIZE];
+};
+
+struct radix_tree_root {
+    uint32_t height; /* 0: empty tree */
+    struct radix_tree_node *rnode;
+};
+
+#define RADIX_TREE_INIT \
+    {                   \
+        0, NULL         \
+    }
+
+void radix_tree_init(struct radix_tree_root *);
+int radix_tree_insert(struct radix_tree_root *, uint64_t, void *);
+void *radix_tree_lookup(const struct radix_tree_root *, uint64_t);
+void *radix_tree_delete(struct radix_tree_root *, uint64_t);
+uint32_t radix_tree_gang_lookup(const struct radix_tree_root *,
+                                void **results,
+                                uint64_t first_index,
+                                uint32_t max_items);
+
+#endif
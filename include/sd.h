@@ -14,7 +14,9 @@
 #define STOP_TRANSMISSION 12
 #define SET_BLOCKLEN 16
 #define READ_SINGLE_BLOCK 17
+#define READ_MULTIPLE_BLOCK 18
 #define WRITE_SINGLE_BLOCK 24
+#define WRITE_MULTIPLE_BLOCK 25
 #define SD_APP_OP_COND 41
 #define SDCARD_3_3V (1 << 21)
 #define SDCARD_ISHCS (1 << 30)
@@ -51,6 +53,7 @@
 #define SDHOST_HSTS_MASK (0x7f8)
 #define SDHOST_HSTS_ERR_MASK (0xf8)
 #define SDHOST_HSTS_DATA (1 << 0)
+#define SDHOST_HSTS_BLOCK (1 << 9)
 #define SDHOST_PWR (SDHOST_BASE + 0x30)
 #define SDHOST_DBG (SDHOST_BASE + 0x34)
 #define SDHOST_DBG_FSM_DATA 1
@@ -59,14 +62,26 @@
 #define SDHOST_DBG_FIFO (0x4 << 14 | 0x4 << 9)
 #define SDHOST_CFG (SDHOST_BASE + 0x38)
 #define SDHOST_CFG_DATA_EN (1 << 4)
+#define SDHOST_CFG_BLOCK_IRPT_EN (1 << 8)
 #define SDHOST_CFG_SLOW (1 << 3)
 #define SDHOST_CFG_INTBUS (1 << 1)
 #define SDHOST_SIZE (SDHOST_BASE + 0x3c)
 #define SDHOST_DATA (SDHOST_BASE + 0x40)
 #define SDHOST_CNT (SDHOST_BASE + 0x50)
+#define SDHOST_IRQ (1 << 24)  // in IRQ_PENDING_2
+
+#define DMA_CHANNEL_SD 5  // not used by the VideoCore firmware
+#define SD_MAX_RETRY 3
+
+struct request;
 
 void sd_init();
-void writeblock(int block_idx, void *buf);
-void readblock(int block_idx, void *buf);
+int sd_do_request(struct request *rq);
+void sd_irq_handler();
+void sd_dma_irq_handler();
+int writeblock(int block_idx, void *buf);
+int writeblocks(int block_idx, int count, void *buf);
+int readblock(int block_idx, void *buf);
+int readblocks(int block_idx, int count, void *buf);
 
 #endif
\ No newline at end of file
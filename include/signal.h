@@ -1,12 +1,33 @@
 #ifndef SIGNAL_H
 #define SIGNAL_H
 
-#include <include/task.h>
+#include <include/list.h>
 #include <include/types.h>
 
-/* This part is taken from include/uapi/asm-generic/signal.h */
+typedef uint32_t pid_t;
+typedef uint32_t sigvec_t;
+
+/*
+ * Signal numbers, one bit each in a sigvec_t. A standard signal sent twice
+ * before delivery is delivered once, every realtime signal sent is queued
+ * and delivered in order along with its value.
+ */
 #define SIGKILL 1
-#define SIGUNUSED 2
+#define SIGINT 2
+#define SIGSEGV 3
+#define SIGUSR1 4
+#define SIGUSR2 5
+#define SIGALRM 6
+#define SIGTERM 7
+#define SIGCHLD 8
+#define SIGRTMIN 16
+#define SIGRTMAX 31
+#define NSIG 32  /* largest signal plus one */
+
+#define sigmask(sig) (1U << ((sig) - 1))
+#define SIG_RT_MASK (~(sigmask(SIGRTMIN) - 1))
+
+#define SIGQUEUE_MAX 32  /* realtime signals a task may have queued */
 
 typedef void (*sig_t)(int32_t);
 
@@ -14,7 +35,57 @@ typedef void (*sig_t)(int32_t);
 #define SIG_IGN ((sig_t) 1)  /* ignore signal */
 #define SIG_ERR ((sig_t) -1) /* error return from signal */
 
-void do_signal();
+/* sa_flags */
+#define SA_SIGINFO 0x1    /* call sa_sigaction instead of sa_handler */
+#define SA_NODEFER 0x2    /* do not block the signal in its handler */
+#define SA_RESETHAND 0x4  /* back to SIG_DFL once delivered */
+
+/* sigprocmask() how */
+enum { SIG_BLOCK, SIG_UNBLOCK, SIG_SETMASK };
+
+typedef struct siginfo {
+    int32_t si_signo;
+    pid_t si_pid;       // sender of a realtime signal
+    uint64_t si_value;  // value of sigqueue(), 0 for kill()
+} siginfo_t;
+
+struct sigaction {
+    union {
+        sig_t sa_handler;
+        void (*sa_sigaction)(int32_t, siginfo_t *, void *);
+    };
+    sigvec_t sa_mask;  // blocked in addition while the handler runs
+    int32_t sa_flags;  // SA_*
+};
+
+/* queued instance of a realtime signal */
+struct sigqueue {
+    siginfo_t info;
+    struct list_head list;
+};
+
+/*
+ * Pushed on the user stack to run a handler, and read back by sigreturn(),
+ * which the handler returns to through the vDSO.
+ */
+struct sigframe {
+    siginfo_t info;
+    uint64_t regs[34];  // x0-x30, sp, pc and pstate of the interrupted code
+    sigvec_t blocked;   // mask to restore
+};
+
+struct task_struct;
+struct TrapFrame;
+
+void do_signal(struct TrapFrame *tf);
 int32_t do_kill(pid_t pid, int32_t sig);
+int32_t do_sigqueue(pid_t pid, int32_t sig, uint64_t value);
+int32_t do_sigaction(int32_t sig,
+                     const struct sigaction *act,
+                     struct sigaction *oldact);
+int32_t do_sigprocmask(int32_t how, const sigvec_t *set, sigvec_t *oldset);
+int64_t do_sigreturn(struct TrapFrame *tf);
+void flush_signal_handlers(struct task_struct *task);
+void flush_sigqueue(struct task_struct *task);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,9 +1,18 @@
 #ifndef STDLIB_H
 #define STDLIB_H
 
+#include <include/types.h>
+
 int atoi(const char *str, int *dst);
 int htoi(const char *str, int *dst);
 char *itoa(char *tmpstr, long int arg);
 char *itoh(char *tmpstr, unsigned long long arg);
 
+// lib/malloc.c
+void *sbrk(intptr_t increment);
+void *malloc(size_t size);
+void *calloc(size_t nmemb, size_t size);
+void *realloc(void *ptr, size_t size);
+void free(void *ptr);
+
 #endif
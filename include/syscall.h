@@ -1,9 +1,12 @@
 #ifndef SYSCALL_H
 #define SYSCALL_H
 
+#include <include/aio.h>
+#include <include/blkdev.h>
 #include <include/exc.h>
 #include <include/signal.h>
 #include <include/task.h>
+#include <include/uring.h>
 #include <include/utils.h>
 
 enum {
@@ -29,6 +32,35 @@ enum {
     SYS_opendir,
     SYS_readdir,
     SYS_closedir,
+    SYS_sync,
+    SYS_fsync,
+    SYS_iostat,
+    SYS_io_submit,
+    SYS_io_getevents,
+    SYS_truncate,
+    SYS_ftruncate,
+    SYS_statfs,
+    SYS_lseek,
+    SYS_pread,
+    SYS_pwrite,
+    SYS_readv,
+    SYS_writev,
+    SYS_sendfile,
+    SYS_msync,
+    SYS_munmap,
+    SYS_mprotect,
+    SYS_brk,
+    SYS_spawn,
+    SYS_madvise,
+    SYS_execve,
+    SYS_io_uring_setup,
+    SYS_io_uring_enter,
+    SYS_sigaction,
+    SYS_sigprocmask,
+    SYS_sigqueue,
+    SYS_sigreturn,
+    SYS_readbench,
+    NR_SYSCALLS
 };
 
 void syscall_handler(struct TrapFrame *tf);
@@ -37,6 +69,7 @@ void syscall_handler(struct TrapFrame *tf);
 int64_t reset(uint64_t);
 int64_t cancel_reset();
 int64_t get_timestamp(struct TimeStamp *);
+int64_t get_timestamp_syscall(struct TimeStamp *);
 int64_t uart_read(void *, size_t);
 int64_t uart_write(void *, size_t);
 uint32_t get_taskid();
@@ -44,7 +77,7 @@ int64_t exec(void *);
 int64_t fork();
 int64_t exit();
 int32_t kill(pid_t, int32_t);
-void *mmap(void *, size_t, int32_t, int32_t, void *, int32_t);
+void *mmap(void *, size_t, int32_t, int32_t, int32_t, off_t);
 int32_t open(char *, int32_t);
 int32_t close(int32_t);
 ssize_t read(int32_t, void *, size_t);
@@ -56,6 +89,34 @@ int32_t mount(char *, char *, char *);
 int32_t opendir(char *, dir_t **);
 int32_t readdir(dir_t *, char *, enum node_attr_flag *, size_t *);
 int32_t closedir(dir_t *);
+int32_t sync();
+int32_t fsync(int32_t);
+int32_t iostat(struct blk_stats *);
+int32_t io_submit(struct iocb *, int32_t);
+int32_t io_getevents(int32_t, int32_t, struct io_event *);
+int32_t truncate(char *, size_t);
+int32_t ftruncate(int32_t, size_t);
+int32_t statfs(char *, struct statfs *);
+off_t lseek(int32_t, off_t, int32_t);
+ssize_t pread(int32_t, void *, size_t, off_t);
+ssize_t pwrite(int32_t, void *, size_t, off_t);
+ssize_t readv(int32_t, const struct iovec *, int32_t);
+ssize_t writev(int32_t, const struct iovec *, int32_t);
+ssize_t sendfile(int32_t, int32_t, off_t *, size_t);
+int32_t msync(void *, size_t, int32_t);
+int32_t munmap(void *, size_t);
+int32_t mprotect(void *, size_t, int32_t);
+void *brk(void *);
+int64_t spawn();
+int32_t madvise(void *, size_t, int32_t);
+int64_t execve(const char *, char *const *, char *const *);
+struct io_uring *io_uring_setup(uint32_t);
+int32_t io_uring_enter(uint32_t);
+int32_t sigaction(int32_t, const struct sigaction *, struct sigaction *);
+int32_t sigprocmask(int32_t, const sigvec_t *, sigvec_t *);
+int32_t sigqueue(pid_t, int32_t, uint64_t);
+int32_t readbench(char *);
+sig_t signal(int32_t, sig_t);
 
 /* wrapper */
 int64_t sys_reset(uint64_t);
@@ -80,5 +141,33 @@ int64_t sys_mount(const char *, const char *, const char *);
 int64_t sys_opendir(char *, dir_t **);
 int64_t sys_readdir(dir_t *, char *, enum node_attr_flag *, size_t *);
 int64_t sys_closedir(dir_t *);
+int64_t sys_sync();
+int64_t sys_fsync(int32_t);
+int64_t sys_iostat(struct blk_stats *);
+int64_t sys_io_submit(struct iocb *, int32_t);
+int64_t sys_io_getevents(int32_t, int32_t, struct io_event *);
+int64_t sys_truncate(char *, size_t);
+int64_t sys_ftruncate(int32_t, size_t);
+int64_t sys_statfs(char *, struct statfs *);
+int64_t sys_lseek(int32_t, off_t, int32_t);
+int64_t sys_pread(int32_t, void *, size_t, off_t);
+int64_t sys_pwrite(int32_t, void *, size_t, off_t);
+int64_t sys_readv(int32_t, const struct iovec *, int32_t);
+int64_t sys_writev(int32_t, const struct iovec *, int32_t);
+int64_t sys_sendfile(int32_t, int32_t, off_t *, size_t);
+int64_t sys_msync(void *, size_t, int32_t);
+int64_t sys_munmap(void *, size_t);
+int64_t sys_mprotect(void *, size_t, int32_t);
+int64_t sys_brk(void *);
+int64_t sys_spawn();
+int64_t sys_madvise(void *, size_t, int32_t);
+int64_t sys_execve(const char *, char *const *, char *const *);
+int64_t sys_io_uring_setup(uint32_t);
+int64_t sys_io_uring_enter(uint32_t);
+int64_t sys_sigaction(int32_t, const struct sigaction *, struct sigaction *);
+int64_t sys_sigprocmask(int32_t, const sigvec_t *, sigvec_t *);
+int64_t sys_sigqueue(pid_t, int32_t, uint64_t);
+int64_t sys_sigreturn(struct TrapFrame *);
+int64_t sys_readbench(char *);
 
 #endif
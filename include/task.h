@@ -10,6 +10,7 @@
 #include <include/list.h>
 #include <include/types.h>
 #include <include/mm.h>
+#include <include/signal.h>
 #include <include/vfs.h>
 
 /* runqueue ring buffer */
@@ -20,6 +21,10 @@
 #define KSTACK_SIZE (1 << 13)
 #define USTACK_SIZE (1 << 13)
 
+/* execve() */
+#define MAX_ARG_STRINGS 32  // strings of argv or envp
+#define ELF_MAX_PHNUM 32    // program headers of an executable
+
 /* file descriptor table */
 #define MAX_FILE_DESCRIPTOR 16
 
@@ -47,9 +52,6 @@ struct task_context {
     uint64_t sp;
 };
 
-typedef uint32_t pid_t;
-typedef uint32_t sigvec_t;
-
 typedef struct task_struct {
     struct task_context task_context;
     pid_t tid;
@@ -57,10 +59,18 @@ typedef struct task_struct {
     uint64_t counter;
     sigvec_t sig_pending;
     sigvec_t sig_blocked;
+    struct sigaction sigactions[NSIG];  // indexed by signal number
+    struct list_head sig_queue;         // queued realtime signals
+    uint32_t sig_queued;
     mm_struct mm;
     struct list_head node;
     file_t *fdt[MAX_FILE_DESCRIPTOR];
     struct fs_struct fs;
+    struct list_head aio_done;  // completed kiocbs, not yet reaped
+    uint32_t aio_nr;            // kiocbs submitted, not yet reaped
+    uint32_t aio_active;        // kiocbs submitted, not yet completed
+    page_t *uring;              // rings of io_uring_setup(), or NULL
+    uint64_t nr_faults;         // page faults since the last exec
 } task_t;
 
 typedef struct runqueue_t {
@@ -76,6 +86,7 @@ bool runqueue_is_full(const runqueue_t *);
 bool runqueue_is_empty(const runqueue_t *);
 void runqueue_push(runqueue_t *, task_t **);
 void runqueue_pop(runqueue_t *, task_t **);
+void wake_up_all(runqueue_t *);
 
 extern runqueue_t runqueue, waitqueue;
 extern struct list_head zombie_list;
@@ -89,7 +100,9 @@ void *get_kstacktop_by_id(uint32_t);
 void *get_ustacktop_by_id(uint32_t);
 uint32_t do_get_taskid();
 int do_exec(uint64_t);
+int do_execve(const char *, char *const[], char *const[]);
 int64_t do_fork(struct TrapFrame *);
+int64_t do_spawn();
 void do_exit();
 int64_t privilege_task_create(void (*)());
 void idle();
@@ -1,6 +1,10 @@
 #ifndef _TLBFLUSH_H
 #define _TLBFLUSH_H
 
+#include <include/mm.h>
+
+#define TLB_FLUSH_RANGE_PAGES 64  /* larger ranges flush the whole TLB */
+
 static inline void flush_tlb_all()
 {
     asm volatile(
@@ -10,4 +14,20 @@ static inline void flush_tlb_all()
         "isb");
 }
 
+/* invalidate the user translations of [start, end) */
+static inline void flush_tlb_range(virtaddr_t start, virtaddr_t end)
+{
+    if ((end - start) >> PAGE_SHIFT > TLB_FLUSH_RANGE_PAGES) {
+        flush_tlb_all();
+        return;
+    }
+    asm volatile("dsb ishst");
+    for (virtaddr_t va = start; va < end; va += PAGE_SIZE) {
+        asm volatile("tlbi vaae1is, %0" ::"r"(va >> PAGE_SHIFT));
+    }
+    asm volatile(
+        "dsb ish\n"
+        "isb");
+}
+
 #endif
@@ -3,14 +3,22 @@
 
 #include <include/types.h>
 #include <include/vfs.h>
+#include <include/pagecache.h>
 
-#define TMPFS_FIEL_BUFFER_MAX_LEN 64
+#define TMPFS_MAX_PAGES 4096  /* pages of file data a mount may hold */
 
+/* file data lives in the page cache of the inode, holes have no page */
 typedef struct tmpfs_node {
     struct inode inode;
-    uint8_t buffer[TMPFS_FIEL_BUFFER_MAX_LEN];
+    struct address_space mapping;
+    struct super_block *sb;  // mount charged for the pages
 } tmpfs_node_t;
 
+struct tmpfs_sb_info {
+    size_t max_pages;
+    size_t used_pages;
+};
+
 void tmpfs_init();
 struct dentry *tmpfs_mount(struct filesystem *fs, const char *name, void *data);
 
@@ -0,0 +1,50 @@
+#ifndef _UACCESS_H
+#define _UACCESS_H
+
+#include <include/mm.h>
+
+/*
+ * Copies between kernel and user memory on behalf of a syscall. A fault on
+ * user memory is resolved like a fault of the task. If it cannot be, the
+ * copy stops at the faulting instruction and reports the failure instead of
+ * taking the kernel down.
+ */
+
+#ifdef __ASSEMBLER__
+
+/* `x` may fault on user memory, resume at `l` if the fault is not resolved */
+#define USER(l, x...)         \
+    9999: x;                  \
+    .section __ex_table, "a"; \
+    .balign 8;                \
+    .quad 9999b, l;           \
+    .previous
+
+#else
+
+#include <include/types.h>
+
+/* an instruction accessing user memory and where it resumes on a bad fault */
+struct exception_table_entry {
+    uint64_t insn;
+    uint64_t fixup;
+};
+
+/* whether [addr, addr + n) lies in the user address range */
+static inline bool access_ok(const void *addr, size_t n)
+{
+    virtaddr_t start = (virtaddr_t) addr;
+    return start + n >= start && start + n <= USER_VIRT_LIMIT;
+}
+
+uint64_t search_exception_table(uint64_t addr);
+size_t copy_from_user(void *to, const void *from, size_t n);
+size_t copy_to_user(void *to, const void *from, size_t n);
+size_t copy_from_buf(void *to, const void *from, size_t n);
+size_t copy_to_buf(void *to, const void *from, size_t n);
+int64_t strncpy_from_user(char *dst, const char *src, size_t count);
+char *getname(const char *pathname);
+
+#endif
+
+#endif
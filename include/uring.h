@@ -0,0 +1,59 @@
+#ifndef _URING_H
+#define _URING_H
+
+#include <include/types.h>
+
+#define URING_MAX_ENTRIES 64  /* entries of each ring, they share one page */
+
+enum {
+    IORING_OP_NOP,
+    IORING_OP_OPEN,
+    IORING_OP_CLOSE,
+    IORING_OP_READ,
+    IORING_OP_WRITE
+};
+
+/* the fd of the sqe is the one returned by the last OPEN of the same enter */
+#define IOSQE_FD_LAST (1 << 0)
+
+/* operation queued by the task */
+struct io_uring_sqe {
+    uint8_t opcode;      // IORING_OP_*
+    uint8_t flags;       // IOSQE_*
+    int32_t fd;          // file of CLOSE, READ and WRITE
+    uint32_t len;        // flags of OPEN, bytes of READ and WRITE
+    int64_t off;         // file position, -1 moves the file offset instead
+    uint64_t addr;       // path of OPEN, buffer of READ and WRITE
+    uint64_t user_data;  // returned in the cqe
+};
+
+/* result of an operation, posted by the kernel in submission order */
+struct io_uring_cqe {
+    uint64_t user_data;
+    int64_t res;  // the syscall result of the operation
+};
+
+/*
+ * Submission and completion rings shared by a task and the kernel. The
+ * producer of a ring only moves its tail, the consumer only its head, and an
+ * index is taken modulo `entries` when it is used.
+ */
+struct io_uring {
+    volatile uint32_t sq_head;  // moved by the kernel
+    volatile uint32_t sq_tail;  // moved by the task
+    volatile uint32_t cq_head;  // moved by the task
+    volatile uint32_t cq_tail;  // moved by the kernel
+    uint32_t entries;           // a power of two
+    struct io_uring_sqe sqes[URING_MAX_ENTRIES];
+    struct io_uring_cqe cqes[URING_MAX_ENTRIES];
+};
+
+struct task_struct;
+
+void exit_uring(struct task_struct *task);
+
+/* for syscall */
+struct io_uring *do_io_uring_setup(uint32_t entries);
+int32_t do_io_uring_enter(uint32_t to_submit);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _VDSO_H
+#define _VDSO_H
+
+#include <include/mm.h>
+
+/*
+ * Page of code mapped read-only above the user stack of every task, so that
+ * user space reads the timestamp and its task id without a trap. Its entry
+ * points are at fixed offsets.
+ */
+#define VDSO_BASE USER_VIRT_TOP
+#define VDSO_GET_TIMESTAMP (VDSO_BASE + 0x0)
+#define VDSO_GET_TASKID (VDSO_BASE + 0x4)
+#define VDSO_SIGRETURN (VDSO_BASE + 0x8)  /* return address of handlers */
+
+#define VDSO_NR_SIGRETURN 48  /* SYS_sigreturn, checked by kernel/syscall.c */
+
+#ifndef __ASSEMBLER__
+
+extern char vdso_start[];
+
+#endif
+
+#endif
@@ -10,6 +10,16 @@ enum file_op_flag {
     O_CREAT = 0b1,
 };
 
+enum { SEEK_SET, SEEK_CUR, SEEK_END };
+
+#define IOV_MAX 16   /* segments of one readv or writev */
+#define PATH_MAX 256 /* bytes of a path passed by a syscall */
+
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+
 enum node_attr_flag {
     DIRECTORY,
     FILE,
@@ -20,9 +30,12 @@ struct vnode {
     struct file_operations *f_ops;
 };
 
+struct address_space;
+
 struct inode {
     size_t size;
-    uint32_t off;  // offset of sfn_t
+    uint32_t off;                     // offset of sfn_t
+    struct address_space *i_mapping;  // cached pages of the file, or NULL
 };
 
 typedef struct dentry {
@@ -36,11 +49,26 @@ typedef struct dentry {
     struct list_head l_head, c_head;  // list of all files
 } dentry_t;
 
+/* sequential readahead state of an opened file */
+struct file_ra_state {
+    uint64_t start;       // first page of the last readahead window
+    uint32_t size;        // number of pages in the last readahead window
+    uint64_t next_index;  // page expected by a sequential reader
+};
+
 typedef struct file {
     dentry_t *dentry;
     size_t f_pos;
+    struct file_ra_state f_ra;
 } file_t;
 
+/* space usage of a mounted filesystem */
+struct statfs {
+    uint64_t f_bsize;   // block size
+    uint64_t f_blocks;  // total blocks
+    uint64_t f_bfree;   // free blocks
+};
+
 typedef struct dir {
     struct list_head *head, *cur;
 } dir_t;
@@ -62,9 +90,10 @@ struct filesystem {
     struct super_block *sb;
 };
 
+/* transfer at *ppos and advance it, file->f_pos is left to the caller */
 struct file_operations {
-    int (*write)(file_t *file, const void *buf, size_t len);
-    int (*read)(file_t *file, void *buf, size_t len);
+    int (*write)(file_t *file, const void *buf, size_t len, size_t *ppos);
+    int (*read)(file_t *file, void *buf, size_t len, size_t *ppos);
 };
 
 struct vnode_operations {
@@ -75,6 +104,7 @@ struct vnode_operations {
                   struct dentry **target,
                   const char *component_name,
                   enum node_attr_flag flag);
+    int (*truncate)(struct dentry *dentry, size_t length);
 };
 
 void register_filesystem(struct filesystem *fs);
@@ -86,22 +116,39 @@ file_t *vfs_open(const char *pathname, int flags);
 int vfs_close(file_t *file);
 int vfs_write(file_t *file, const void *buf, size_t len);
 int vfs_read(file_t *file, void *buf, size_t len);
+int vfs_pwrite(file_t *file, const void *buf, size_t len, size_t pos);
+int vfs_pread(file_t *file, void *buf, size_t len, size_t pos);
+off_t vfs_lseek(file_t *file, off_t offset, int whence);
+ssize_t vfs_sendfile(file_t *out, file_t *in, size_t *ppos, size_t count);
 dir_t *vfs_opendir(char *pathname);
 dentry_t *vfs_readdir(dir_t *dir);
 void vfs_closedir(dir_t *dir);
 int vfs_mkdir(char *pathname);
 int vfs_chdir(char *pathname);
 int vfs_getcwd(char *pathname, size_t size);
+int vfs_truncate(dentry_t *dentry, size_t length);
 void vfs_test();
+int32_t vfs_read_bench(const char *pathname);
 
 /* for syscall */
 int32_t do_open(char *pathname, int32_t flags);
 int32_t do_close(int32_t fd);
 ssize_t do_write(int32_t fd, void *buf, size_t size);
 ssize_t do_read(int32_t fd, void *buf, size_t size);
+ssize_t do_pwrite(int32_t fd, void *buf, size_t size, off_t offset);
+ssize_t do_pread(int32_t fd, void *buf, size_t size, off_t offset);
+off_t do_lseek(int32_t fd, off_t offset, int32_t whence);
+ssize_t do_readv(int32_t fd, const struct iovec *iov, int32_t iovcnt);
+ssize_t do_writev(int32_t fd, const struct iovec *iov, int32_t iovcnt);
+ssize_t do_sendfile(int32_t out_fd, int32_t in_fd, off_t *offset, size_t count);
 int32_t do_mkdir(char *pathname);
 int32_t do_chdir(char *pathname);
 int32_t do_getcwd(char *pathname, size_t size);
+int32_t do_sync();
+int32_t do_fsync(int32_t fd);
+int32_t do_truncate(char *pathname, size_t length);
+int32_t do_ftruncate(int32_t fd, size_t length);
+int32_t do_statfs(char *pathname, struct statfs *buf);
 
 extern struct dentry *root_dir;
 
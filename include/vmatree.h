@@ -0,0 +1,36 @@
+#ifndef _VMATREE_H
+#define _VMATREE_H
+
+#include <include/list.h>
+#include <include/types.h>
+
+struct vm_area_struct;
+
+/* VMAs of an address space, see kernel/vmatree.c */
+struct vma_tree {
+    struct vm_area_struct *root;
+    struct list_head vma_list;     // VMAs in address order
+    virtaddr_t min, max;           // range VMAs are placed in
+    struct vm_area_struct *cache;  // VMA of the last lookup
+    uint32_t nr_vmas;
+};
+
+#define vt_for_each(__tree, __vma) \
+    list_for_each_entry(__vma, &(__tree)->vma_list, vm_list)
+
+void vt_init(struct vma_tree *tree, virtaddr_t min, virtaddr_t max);
+void vt_destroy(struct vma_tree *tree);
+struct vm_area_struct *vt_find(struct vma_tree *tree, virtaddr_t addr);
+struct vm_area_struct *vt_find_above(struct vma_tree *tree, virtaddr_t addr);
+struct vm_area_struct *vt_next(struct vma_tree *tree,
+                               struct vm_area_struct *vma);
+int32_t vt_find_gap(struct vma_tree *tree,
+                    virtaddr_t min,
+                    virtaddr_t max,
+                    size_t size,
+                    virtaddr_t *start);
+int32_t vt_insert(struct vma_tree *tree, struct vm_area_struct *vma);
+void vt_erase(struct vma_tree *tree, struct vm_area_struct *vma);
+void vt_update(struct vma_tree *tree, struct vm_area_struct *vma);
+
+#endif
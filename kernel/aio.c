@@ -0,0 +1,211 @@
+#include <include/aio.h>
+#include <include/irq.h>
+#include <include/list.h>
+#include <include/sched.h>
+#include <include/slab.h>
+#include <include/string.h>
+#include <include/task.h>
+#include <include/types.h>
+#include <include/uaccess.h>
+#include <include/utils.h>
+#include <include/vfs.h>
+
+/*
+ * Asynchronous file I/O. io_submit() copies the iocbs into kiocbs queued for
+ * the kaiod task, which does the positional transfer on a kernel buffer, so
+ * the submitter goes on meanwhile. Completed kiocbs are
+ * moved to the submitter's aio_done list, io_getevents() reaps them and
+ * copies read data to the user buffer in the submitter's address space.
+ *
+ * The lists are shared by syscalls and kaiod, they are protected by masking
+ * IRQ.
+ */
+
+static LIST_HEAD(aio_queue);
+static runqueue_t kaiod_waitqueue;  // kaiod, sleeping on an empty aio_queue
+static runqueue_t aio_waitqueue;    // tasks waiting for completions
+
+void aio_init()
+{
+    runqueue_init(&kaiod_waitqueue);
+    runqueue_init(&aio_waitqueue);
+}
+
+/* sleep on `q` until woken up, IRQ must be masked */
+static void sleep_on(runqueue_t *q)
+{
+    task_t *cur = (task_t *) get_current();
+    cur->state = TASK_BLOCKED;
+    runqueue_push(q, &cur);
+    schedule();
+}
+
+static void free_kiocb(struct kiocb *req)
+{
+    kfree(req->ki_buf);
+    kfree(req);
+}
+
+/* `iocb` is the kernel copy of the user iocb, its aio_buf is a user buffer */
+static struct kiocb *alloc_kiocb(task_t *task, const struct iocb *iocb)
+{
+    file_t *file;
+    struct kiocb *req;
+    int32_t fd = iocb->aio_fildes;
+
+    if (fd < 0 || fd >= MAX_FILE_DESCRIPTOR || !(file = task->fdt[fd]) ||
+        (iocb->aio_lio_opcode != IOCB_CMD_PREAD &&
+         iocb->aio_lio_opcode != IOCB_CMD_PWRITE) ||
+        !iocb->aio_buf || !iocb->aio_nbytes ||
+        iocb->aio_nbytes > AIO_MAX_BYTES ||
+        !access_ok(iocb->aio_buf, iocb->aio_nbytes)) {
+        return NULL;
+    }
+    if (!(req = kzalloc(sizeof(*req)))) {
+        return NULL;
+    }
+    if (!(req->ki_buf = kmalloc(iocb->aio_nbytes))) {
+        kfree(req);
+        return NULL;
+    }
+    if (iocb->aio_lio_opcode == IOCB_CMD_PWRITE &&
+        copy_from_user(req->ki_buf, iocb->aio_buf, iocb->aio_nbytes)) {
+        free_kiocb(req);
+        return NULL;
+    }
+    req->ki_iocb = *iocb;
+    req->ki_task = task;
+    req->ki_file.dentry = file->dentry;
+    INIT_LIST_HEAD(&req->ki_node);
+    return req;
+}
+
+/* return the number of iocbs queued, or -1 if the first one is rejected */
+int32_t do_io_submit(struct iocb *iocbs, int32_t nr)
+{
+    task_t *cur = (task_t *) get_current();
+    struct kiocb *req;
+    struct iocb iocb;
+    uint64_t daif;
+    int32_t i;
+
+    if (!iocbs || nr < 0) {
+        return -1;
+    }
+    for (i = 0; i < nr && cur->aio_nr < AIO_MAX_NR; i++) {
+        if (copy_from_user(&iocb, &iocbs[i], sizeof(iocb)) ||
+            !(req = alloc_kiocb(cur, &iocb))) {
+            break;
+        }
+        daif = irq_save();
+        list_add_tail(&req->ki_node, &aio_queue);
+        cur->aio_nr++;
+        cur->aio_active++;
+        wake_up_all(&kaiod_waitqueue);
+        irq_restore(daif);
+    }
+    return (i || !nr) ? i : -1;
+}
+
+/*
+ * Reap at least `min_nr` and at most `nr` completed iocbs into `events`,
+ * sleeping until enough of them complete. Return the number reaped.
+ */
+int32_t do_io_getevents(int32_t min_nr, int32_t nr, struct io_event *events)
+{
+    task_t *cur = (task_t *) get_current();
+    struct kiocb *req;
+    struct io_event event;
+    uint64_t daif;
+    int32_t n = 0;
+
+    if (!events || min_nr < 0 || nr < min_nr ||
+        (uint32_t) min_nr > cur->aio_nr ||
+        !access_ok(events, (size_t) nr * sizeof(*events))) {
+        return -1;
+    }
+    while (n < nr) {
+        daif = irq_save();
+        if (list_empty(&cur->aio_done)) {
+            if (n >= min_nr) {
+                irq_restore(daif);
+                break;
+            }
+            sleep_on(&aio_waitqueue);
+            irq_restore(daif);
+            continue;
+        }
+        req = list_first_entry(&cur->aio_done, struct kiocb, ki_node);
+        list_del(&req->ki_node);
+        cur->aio_nr--;
+        irq_restore(daif);
+
+        event.data = req->ki_iocb.aio_data;
+        event.res = req->ki_res;
+        if (req->ki_iocb.aio_lio_opcode == IOCB_CMD_PREAD && req->ki_res > 0 &&
+            copy_to_user(req->ki_iocb.aio_buf, req->ki_buf, req->ki_res)) {
+            event.res = -1;
+        }
+        free_kiocb(req);
+        // the result is lost if the events array was unmapped meanwhile
+        if (copy_to_user(&events[n], &event, sizeof(event))) {
+            return n ? n : -1;
+        }
+        n++;
+    }
+    return n;
+}
+
+/* wait for the iocbs of an exiting task and drop their results */
+void exit_aio(task_t *task)
+{
+    struct kiocb *req, *tmp;
+    uint64_t daif = irq_save();
+
+    while (task->aio_active) {
+        sleep_on(&aio_waitqueue);
+    }
+    list_for_each_entry_safe(req, tmp, &task->aio_done, ki_node)
+    {
+        list_del(&req->ki_node);
+        free_kiocb(req);
+    }
+    task->aio_nr = 0;
+    irq_restore(daif);
+}
+
+/* kernel task doing the transfers of queued iocbs, one at a time */
+void kaiod()
+{
+    struct kiocb *req;
+    size_t len, pos;
+    int ret;
+
+    enable_irq();
+    while (1) {
+        disable_irq();
+        if (list_empty(&aio_queue)) {
+            sleep_on(&kaiod_waitqueue);
+            enable_irq();
+            continue;
+        }
+        req = list_first_entry(&aio_queue, struct kiocb, ki_node);
+        list_del_init(&req->ki_node);
+
+        // IRQ stays masked as in a syscall, the filesystems rely on it and
+        // waiting for the SD card still lets other tasks run
+        len = req->ki_iocb.aio_nbytes;
+        pos = req->ki_iocb.aio_offset;
+        if (req->ki_iocb.aio_lio_opcode == IOCB_CMD_PREAD) {
+            ret = vfs_pread(&req->ki_file, req->ki_buf, len, pos);
+        } else {
+            ret = vfs_pwrite(&req->ki_file, req->ki_buf, len, pos);
+        }
+        req->ki_res = ret < 0 ? -1 : ret;
+
+        list_add_tail(&req->ki_node, &req->ki_task->aio_done);
+        req->ki_task->aio_active--;
+        wake_up_all(&aio_waitqueue);
+        enable_irq();
+    }
+}
@@ -0,0 +1,268 @@
+#include <include/blkdev.h>
+#include <include/irq.h>
+#include <include/list.h>
+#include <include/sched.h>
+#include <include/sd.h>
+#include <include/string.h>
+#include <include/task.h>
+#include <include/types.h>
+#include <include/utils.h>
+
+/*
+ * Request queue of the SD card. Submitted bios are merged into a queued
+ * request when their sectors are adjacent, and requests are kept in sector
+ * order. Running the queue issues one command per request, so callers submit
+ * all the bios they have before running it.
+ *
+ * Once the kblockd task runs, it is the only one driving the controller:
+ * running the queue wakes it up and waiters sleep on blk_waitqueue until a
+ * request completes, also when it entered with IRQ masked. Before that, at
+ * boot, the caller drives the controller itself.
+ */
+
+static struct request request_pool[BLK_NR_REQUESTS];
+static LIST_HEAD(free_requests);
+static LIST_HEAD(request_queue);
+static struct blk_stats stats;
+static bool queue_busy;  // a task is driving the controller
+static task_t *kblockd_task;
+static runqueue_t kblockd_waitqueue, blk_waitqueue;
+
+static void __blk_run_queue();
+
+void blk_init()
+{
+    for (int i = 0; i < BLK_NR_REQUESTS; i++) {
+        list_add_tail(&request_pool[i].queuelist, &free_requests);
+    }
+    runqueue_init(&kblockd_waitqueue);
+    runqueue_init(&blk_waitqueue);
+}
+
+void bio_init(struct bio *bio,
+              enum req_op op,
+              uint32_t sector,
+              uint32_t count,
+              void *buf)
+{
+    bio->bi_op = op;
+    bio->bi_sector = sector;
+    bio->bi_count = count;
+    bio->bi_buf = buf;
+    bio->bi_done = false;
+    bio->bi_error = 0;
+    bio->bi_end_io = NULL;
+    bio->bi_private = NULL;
+    INIT_LIST_HEAD(&bio->bi_node);
+}
+
+/*
+ * Have the queued requests served and return once some of them completed.
+ * Called with IRQ masked, `daif` is the state to restore.
+ */
+static void blk_wait_completion(uint64_t daif)
+{
+    if (!kblockd_task) {
+        irq_restore(daif);
+        __blk_run_queue();
+        return;
+    }
+    task_t *cur = (task_t *) get_current();
+    wake_up_all(&kblockd_waitqueue);
+    cur->state = TASK_BLOCKED;
+    runqueue_push(&blk_waitqueue, &cur);
+    schedule();
+    irq_restore(daif);
+}
+
+/* append or prepend `bio` to a queued request, IRQ must be masked */
+static bool merge_bio(struct bio *bio)
+{
+    struct request *rq;
+
+    list_for_each_entry(rq, &request_queue, queuelist)
+    {
+        if (rq->op != bio->bi_op ||
+            rq->count + bio->bi_count > BLK_MAX_SECTORS) {
+            continue;
+        }
+        if (rq->sector + rq->count == bio->bi_sector) {
+            list_add_tail(&bio->bi_node, &rq->bios);
+        } else if (bio->bi_sector + bio->bi_count == rq->sector) {
+            list_add(&bio->bi_node, &rq->bios);
+            rq->sector = bio->bi_sector;
+        } else {
+            continue;
+        }
+        rq->count += bio->bi_count;
+        stats.merges[bio->bi_op]++;
+        return true;
+    }
+    return false;
+}
+
+void blk_submit_bio(struct bio *bio)
+{
+    struct request *rq, *pos;
+    uint64_t daif;
+
+    while (1) {
+        daif = irq_save();
+        if (merge_bio(bio)) {
+            irq_restore(daif);
+            return;
+        }
+        if (!list_empty(&free_requests)) {
+            break;
+        }
+        // every request is queued, wait for one to complete
+        blk_wait_completion(daif);
+    }
+
+    rq = list_first_entry(&free_requests, struct request, queuelist);
+    list_del(&rq->queuelist);
+    rq->op = bio->bi_op;
+    rq->sector = bio->bi_sector;
+    rq->count = bio->bi_count;
+    INIT_LIST_HEAD(&rq->bios);
+    list_add_tail(&bio->bi_node, &rq->bios);
+
+    list_for_each_entry(pos, &request_queue, queuelist)
+    {
+        if (pos->sector > rq->sector) {
+            break;
+        }
+    }
+    list_add_tail(&rq->queuelist, &pos->queuelist);
+    irq_restore(daif);
+}
+
+/* issue every queued request, bios are done when this returns */
+static void __blk_run_queue()
+{
+    LIST_HEAD(dispatch);
+    struct request *rq, *tmp;
+    struct bio *bio, *next;
+    struct TimeStamp begin, end;
+    uint64_t daif;
+    int ret;
+
+    while (1) {
+        daif = irq_save();
+        if (!queue_busy) {
+            queue_busy = true;
+            list_splice_init(&request_queue, &dispatch);
+            irq_restore(daif);
+            break;
+        }
+        irq_restore(daif);
+        schedule();
+    }
+
+    list_for_each_entry_safe(rq, tmp, &dispatch, queuelist)
+    {
+        do_get_timestamp(&begin);
+        ret = sd_do_request(rq);
+        do_get_timestamp(&end);
+
+        daif = irq_save();
+        stats.ios[rq->op]++;
+        stats.sectors[rq->op] += rq->count;
+        stats.ticks[rq->op] += end.counts - begin.counts;
+        // a bio may be freed by its owner once it is done
+        list_for_each_entry_safe(bio, next, &rq->bios, bi_node)
+        {
+            bio->bi_error = ret;
+            if (bio->bi_end_io) {
+                bio->bi_end_io(bio);
+            }
+            bio->bi_done = true;
+        }
+        list_move(&rq->queuelist, &free_requests);
+        wake_up_all(&blk_waitqueue);
+        irq_restore(daif);
+    }
+
+    daif = irq_save();
+    queue_busy = false;
+    irq_restore(daif);
+}
+
+/* start serving the queued requests, completion is reported to the bios */
+void blk_run_queue()
+{
+    uint64_t daif = irq_save();
+
+    if (!kblockd_task) {
+        irq_restore(daif);
+        __blk_run_queue();
+        return;
+    }
+    wake_up_all(&kblockd_waitqueue);
+    irq_restore(daif);
+}
+
+int blk_wait_bio(struct bio *bio)
+{
+    uint64_t daif = irq_save();
+
+    while (!bio->bi_done) {
+        blk_wait_completion(daif);
+        daif = irq_save();
+    }
+    irq_restore(daif);
+    return bio->bi_error;
+}
+
+/* synchronous transfer, split into bios of at most BLK_MAX_SECTORS */
+int blk_rw(enum req_op op, uint32_t sector, uint32_t count, void *buf)
+{
+    struct bio bio;
+    int ret;
+
+    while (count > 0) {
+        uint32_t n = MIN(count, BLK_MAX_SECTORS);
+        bio_init(&bio, op, sector, n, buf);
+        blk_submit_bio(&bio);
+        if ((ret = blk_wait_bio(&bio))) {
+            return ret;
+        }
+        sector += n;
+        count -= n;
+        buf += n * BLK_SECTOR_SIZE;
+    }
+    return 0;
+}
+
+int64_t do_iostat(struct blk_stats *user_stats)
+{
+    uint64_t daif;
+
+    if (!user_stats) {
+        return -1;
+    }
+    daif = irq_save();
+    memcpy(user_stats, &stats, sizeof(stats));
+    irq_restore(daif);
+    return 0;
+}
+
+/* kernel task owning the SD controller, serves requests as they are queued */
+void kblockd()
+{
+    task_t *cur = (task_t *) get_current();
+
+    kblockd_task = cur;
+    enable_irq();
+    while (1) {
+        __blk_run_queue();
+
+        disable_irq();
+        if (list_empty(&request_queue)) {
+            cur->state = TASK_BLOCKED;
+            runqueue_push(&kblockd_waitqueue, &cur);
+            schedule();
+        }
+        enable_irq();
+    }
+}
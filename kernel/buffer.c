@@ -0,0 +1,244 @@
+#include <include/buffer.h>
+#include <include/blkdev.h>
+#include <include/error.h>
+#include <include/fat.h>
+#include <include/irq.h>
+#include <include/list.h>
+#include <include/list_sort.h>
+#include <include/sched.h>
+#include <include/sd.h>
+#include <include/slab.h>
+#include <include/string.h>
+#include <include/types.h>
+#include <include/utils.h>
+
+/*
+ * Block buffer cache of the SD card. Writes only dirty the cached block, they
+ * reach the card when sync_blockdev() is called explicitly or by bdflush once
+ * the oldest dirty block has waited BDFLUSH_INTERVAL seconds. Dirty blocks are
+ * submitted in block order so the block layer merges adjacent ones into one
+ * command.
+ *
+ * The lists are touched by user tasks in syscalls and by bdflush, they are
+ * protected by masking IRQ. Card I/O is done outside the critical sections,
+ * a buffer is pinned by b_count meanwhile.
+ */
+
+static struct list_head hash_table[BH_HASH_SIZE];
+static LIST_HEAD(lru_list);
+static LIST_HEAD(dirty_list);
+static uint32_t nr_buffers;
+
+static inline struct list_head *bh_hash(uint32_t blocknr)
+{
+    return &hash_table[blocknr % BH_HASH_SIZE];
+}
+
+void buffer_init()
+{
+    for (int i = 0; i < BH_HASH_SIZE; i++) {
+        INIT_LIST_HEAD(&hash_table[i]);
+    }
+}
+
+static struct buffer_head *find_buffer(uint32_t blocknr)
+{
+    struct buffer_head *bh;
+    list_for_each_entry(bh, bh_hash(blocknr), b_hash)
+    {
+        if (bh->b_blocknr == blocknr) {
+            return bh;
+        }
+    }
+    return NULL;
+}
+
+/* allocate a new buffer or recycle the least recently used clean one */
+static struct buffer_head *get_free_buffer()
+{
+    struct buffer_head *bh;
+
+    if (nr_buffers < NR_BUFFERS && (bh = kzalloc(sizeof(*bh)))) {
+        if ((bh->b_data = kmalloc(SECTOR_SIZE))) {
+            INIT_LIST_HEAD(&bh->b_hash);
+            INIT_LIST_HEAD(&bh->b_lru);
+            INIT_LIST_HEAD(&bh->b_dirty);
+            INIT_LIST_HEAD(&bh->b_io);
+            nr_buffers++;
+            return bh;
+        }
+        kfree(bh);
+    }
+
+    list_for_each_entry(bh, &lru_list, b_lru)
+    {
+        if (!bh->b_count && !(bh->b_state & BH_DIRTY)) {
+            list_del_init(&bh->b_hash);
+            bh->b_state = 0;
+            return bh;
+        }
+    }
+    return NULL;
+}
+
+/* return the held buffer of `blocknr`, its content is valid if BH_UPTODATE */
+struct buffer_head *getblk(uint32_t blocknr)
+{
+    struct buffer_head *bh;
+    uint64_t daif;
+
+    while (1) {
+        daif = irq_save();
+        if (!(bh = find_buffer(blocknr)) && (bh = get_free_buffer())) {
+            bh->b_blocknr = blocknr;
+            list_add(&bh->b_hash, bh_hash(blocknr));
+        }
+        if (bh) {
+            bh->b_count++;
+            list_move_tail(&bh->b_lru, &lru_list);
+        }
+        irq_restore(daif);
+
+        if (bh) {
+            return bh;
+        }
+        // every buffer is dirty or held, write back to make clean ones
+        sync_blockdev();
+    }
+}
+
+/* return the held buffer of `blocknr` read from the card, NULL on I/O error */
+struct buffer_head *bread(uint32_t blocknr)
+{
+    struct buffer_head *bh = getblk(blocknr);
+    uint64_t daif;
+
+    if (!(bh->b_state & BH_UPTODATE)) {
+        if (readblock(blocknr, bh->b_data)) {
+            brelse(bh);
+            return NULL;
+        }
+        daif = irq_save();
+        bh->b_state |= BH_UPTODATE;
+        irq_restore(daif);
+    }
+    return bh;
+}
+
+void brelse(struct buffer_head *bh)
+{
+    uint64_t daif = irq_save();
+    bh->b_count--;
+    irq_restore(daif);
+}
+
+void mark_buffer_dirty(struct buffer_head *bh)
+{
+    struct TimeStamp ts;
+    uint64_t daif;
+
+    do_get_timestamp(&ts);
+    daif = irq_save();
+    bh->b_state |= BH_UPTODATE;
+    if (!(bh->b_state & BH_DIRTY)) {
+        bh->b_state |= BH_DIRTY;
+        bh->b_dirtied = ts.counts;
+        list_add_tail(&bh->b_dirty, &dirty_list);
+    }
+    irq_restore(daif);
+}
+
+/*
+ * Overwrite blocks just read from the card with their cached copies, so
+ * readers bypassing the cache see data not yet written back, including blocks
+ * being written back meanwhile.
+ */
+void buffer_copy_cached(uint32_t blocknr, uint32_t count, void *buf)
+{
+    struct buffer_head *bh;
+    uint64_t daif = irq_save();
+
+    for (uint32_t i = 0; i < count; i++) {
+        if ((bh = find_buffer(blocknr + i)) && (bh->b_state & BH_UPTODATE)) {
+            memcpy(buf + i * SECTOR_SIZE, bh->b_data, SECTOR_SIZE);
+        }
+    }
+    irq_restore(daif);
+}
+
+static int blocknr_cmp(void *priv,
+                       const struct list_head *a,
+                       const struct list_head *b)
+{
+    const struct buffer_head *x = list_entry(a, const struct buffer_head, b_io);
+    const struct buffer_head *y = list_entry(b, const struct buffer_head, b_io);
+    return x->b_blocknr > y->b_blocknr;
+}
+
+/* write all dirty buffers back, runs of adjacent blocks are written at once */
+int sync_blockdev()
+{
+    LIST_HEAD(io_list);
+    struct buffer_head *bh, *tmp;
+    uint64_t daif;
+    int ret = 0;
+
+    daif = irq_save();
+    list_for_each_entry_safe(bh, tmp, &dirty_list, b_dirty)
+    {
+        list_del_init(&bh->b_dirty);
+        bh->b_state &= ~BH_DIRTY;
+        bh->b_count++;
+        list_add_tail(&bh->b_io, &io_list);
+    }
+    irq_restore(daif);
+
+    if (list_empty(&io_list)) {
+        return 0;
+    }
+
+    // sorted submission lets each bio merge into the request before it
+    list_sort(NULL, &io_list, blocknr_cmp);
+    list_for_each_entry(bh, &io_list, b_io)
+    {
+        bio_init(&bh->b_bio, REQ_WRITE, bh->b_blocknr, 1, bh->b_data);
+        blk_submit_bio(&bh->b_bio);
+    }
+    blk_run_queue();
+
+    list_for_each_entry_safe(bh, tmp, &io_list, b_io)
+    {
+        // keep a block that failed to be written dirty
+        if (blk_wait_bio(&bh->b_bio)) {
+            mark_buffer_dirty(bh);
+            ret = -E_IO;
+        }
+        list_del_init(&bh->b_io);
+        brelse(bh);
+    }
+    return ret;
+}
+
+/* kernel task writing dirty buffers back once they get old */
+void bdflush()
+{
+    struct buffer_head *oldest;
+    struct TimeStamp ts;
+    uint64_t daif;
+    bool expired;
+
+    while (1) {
+        do_get_timestamp(&ts);
+        daif = irq_save();
+        oldest = list_first_entry(&dirty_list, struct buffer_head, b_dirty);
+        expired = !list_empty(&dirty_list) &&
+                  ts.counts - oldest->b_dirtied >= BDFLUSH_INTERVAL * ts.freq;
+        irq_restore(daif);
+
+        if (expired) {
+            sync_blockdev();
+        }
+        schedule();
+        enable_irq();
+    }
+}
@@ -0,0 +1,44 @@
+#include <include/console.h>
+#include <include/peripherals/uart.h>
+#include <include/sched.h>
+#include <include/types.h>
+#include <include/vfs.h>
+
+/*
+ * /dev/console is a tmpfs file whose file operations go to the UART, so the
+ * UART can be the source or the target of file syscalls such as sendfile.
+ * The position is ignored.
+ */
+
+static int console_write(file_t *file,
+                         const void *buf,
+                         size_t len,
+                         size_t *ppos)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        if (!(n = _uart_write((void *) buf + done, len - done))) {
+            schedule();  // TX ring buffer is full, let it drain
+        }
+        done += n;
+    }
+    return done;
+}
+
+static int console_read(file_t *file, void *buf, size_t len, size_t *ppos)
+{
+    return _uart_read(buf, len);
+}
+
+void console_init()
+{
+    file_t *file = vfs_open(CONSOLE_PATH, O_CREAT);
+
+    if (file) {
+        file->dentry->vnode->f_ops->write = console_write;
+        file->dentry->vnode->f_ops->read = console_read;
+        vfs_close(file);
+    }
+}
@@ -4,13 +4,14 @@
 #include <include/syscall.h>
 #include <include/types.h>
 #include <include/task.h>
-#include <include/btree.h>
+#include <include/vmatree.h>
 #include <include/mman.h>
 #include <include/string.h>
 #include <include/arm/mmu.h>
 #include <include/assert.h>
 #include <include/pgtable.h>
 #include <include/tlbflush.h>
+#include <include/uaccess.h>
 
 const static char *entry_error_messages[] = {
     "SYNC_INVALID_EL1t",   "IRQ_INVALID_EL1t",
@@ -38,12 +39,14 @@ void show_invalid_entry_message(struct TrapFrame *tf)
                     ESR & ((1 << ESR_ELx_IL_SHIFT) - 1));
 }
 
-static inline void page_fault_handler(struct TrapFrame *tf)
+/*
+ * Resolve a fault of the current task at `fault_addr`, taken by the task or
+ * by the kernel accessing its memory. Return 0 if the access may be retried.
+ */
+static int32_t do_page_fault(struct TrapFrame *tf, uint64_t fault_addr)
 {
     uint32_t ISS = (tf->esr_el1) & ((1 << ESR_ELx_IL_SHIFT) - 1),
              FSC = ISS & 0b111111;
-    uint64_t fault_addr;
-    asm volatile("mrs %0, far_el1" : "=r"(fault_addr) :);
 
     KERNEL_LOG_DEBUG("Fault address 0x%x", fault_addr);
 
@@ -79,55 +82,42 @@ static inline void page_fault_handler(struct TrapFrame *tf)
      */
 
     task_t *cur = (task_t *) get_current();
-    btree *bt = &cur->mm.mm_bt;
 
     // (1)
-    b_key *key = bt_find_key(bt->root, fault_addr);
-    if (!key) {
-        KERNEL_LOG_INFO("segmentation fault");
-        do_exit();
-        return;
+    struct vm_area_struct *vma = vt_find(&cur->mm.mm_vt, fault_addr);
+    if (!vma) {
+        return -1;
     }
 
     // (2)
-    struct vm_area_struct *vma = (struct vm_area_struct *) (key->entry);
     pgprot_t prot = vma->vm_page_prot;
     bool WnR = tf->esr_el1 & (1ull << 6);
-    // user tries to write a read-only region
-    if ((pgprot_val(prot) & PD_ACCESS_PERM_2) && WnR) {
-        KERNEL_LOG_INFO("segmentation fault");
-        do_exit();
-        return;
+    // user tries to write a read-only region, or to touch a PROT_NONE one
+    if (((pgprot_val(prot) & PD_ACCESS_PERM_2) && WnR) ||
+        !(pgprot_val(prot) & PD_ACCESS_PERM_1)) {
+        return -1;
     }
 
-    virtaddr_t va = ROUNDDOWN(fault_addr, PAGE_SIZE);
-    page_t *pp = page_alloc();
-    assert(pp);
-
     // (3) & (4)
-    pte_t *ptep;
-    if (follow_pte(&cur->mm, va, &ptep) == 0) {
-        // copy on write
-        memcpy((void *) PA_TO_KVA(page2pa(pp)),
-               (void *) PA_TO_KVA(__pte_to_phys(*ptep)), PAGE_SIZE);
-        memcpy((void *) PA_TO_KVA(page2pa(pp)),
-               (void *) PA_TO_KVA(__pte_to_phys(*ptep)), PAGE_SIZE);
-        unmap_page(&cur->mm, va);
-    } else {
-        // demand paging
-        memset((void *) PA_TO_KVA(page2pa(pp)), 0, PAGE_SIZE);
-        if (vma->vm_file_start != (kernaddr_t) NULL) {
-            kernaddr_t addr =
-                vma->vm_file_start + vma->vm_file_offset + (va - vma->vm_start);
-            size_t size =
-                MIN(PAGE_SIZE, vma->vm_file_len - (va - vma->vm_start));
-            memcpy((void *) PA_TO_KVA(page2pa(pp)), (void *) addr, size);
-        }
+    virtaddr_t va = ROUNDDOWN(fault_addr, PAGE_SIZE);
+    cur->nr_faults++;
+    if (handle_mm_fault(&cur->mm, vma, va, WnR)) {
+        return -1;
     }
 
-    insert_page(&cur->mm, pp, va, prot);
-
     flush_tlb_all();
+    return 0;
+}
+
+static inline void page_fault_handler(struct TrapFrame *tf)
+{
+    uint64_t fault_addr;
+    asm volatile("mrs %0, far_el1" : "=r"(fault_addr) :);
+
+    if (do_page_fault(tf, fault_addr)) {
+        KERNEL_LOG_INFO("segmentation fault");
+        do_exit();
+    }
 }
 
 static inline void inst_abort_handler(struct TrapFrame *tf)
@@ -159,6 +149,35 @@ void sync_handler(struct TrapFrame *tf)
     }
 }
 
+/*
+ * Synchronous exception of the kernel. A fault on user memory is resolved
+ * like a fault of the task. If it cannot be, a user copy routine resumes at
+ * its fixup, and any other access to the bad user pointer kills the task.
+ */
+void el1_sync_handler(struct TrapFrame *tf)
+{
+    uint32_t EC = (tf->esr_el1 >> ESR_ELx_EC_SHIFT) & 0xFFFFFF;
+    uint64_t fault_addr, fixup;
+    asm volatile("mrs %0, far_el1" : "=r"(fault_addr) :);
+
+    if (EC == ESR_ELx_EC_DATA_ABORT_CUR) {
+        if (fault_addr < USER_VIRT_LIMIT && !do_page_fault(tf, fault_addr)) {
+            return;
+        }
+        if ((fixup = search_exception_table(tf->elr_el1))) {
+            tf->elr_el1 = fixup;
+            return;
+        }
+        if (fault_addr < USER_VIRT_LIMIT) {
+            KERNEL_LOG_INFO("segmentation fault in kernel at 0x%x",
+                            tf->elr_el1);
+            do_exit();
+        }
+    }
+    show_invalid_entry_message(tf);
+    panic("kernel fault at 0x%x", fault_addr);
+}
+
 void svc_handler(struct TrapFrame *tf)
 {
     syscall_handler(tf);
@@ -5,7 +5,9 @@
 #include <include/stdio.h>
 #include <include/string.h>
 #include <include/slab.h>
+#include <include/buffer.h>
 #include <include/sd.h>
+#include <include/error.h>
 
 #define get_first_sector_of_cluster(sectors_per_cluster, first_data_sector, \
                                     cluster)                                \
@@ -16,7 +18,15 @@ static unsigned char longFilePos[] = {30, 28, 24, 22, 20, 18, 16,
                                       14, 9,  7,  5,  3,  1};
 
 uint32_t bytesPerSector, sectorsPerCluster, bytesPerCluster, fatStart,
-    rootCluster, dataStart;
+    rootCluster, dataStart, clusterCount, fsInfoAddress;
+
+/*
+ * One bit per cluster, set if the cluster is in use. It is built from the FAT
+ * on the first allocation, until then the free count comes from FSInfo.
+ */
+static uint64_t *freeMap;
+static uint32_t freeCount = FSINFO_UNKNOWN, nextFree = FSINFO_UNKNOWN;
+static bool fsInfoDirty;
 
 uint32_t clusterAddress(uint32_t cluster, bool isRoot)
 {
@@ -170,41 +180,52 @@ void get_entries(uint8_t *cluster, uint32_t size, struct list_head *head)
     xstr_destroy(letters);
 }
 
-void readData(uint32_t address, char *buffer, int size)
+/* byte granular access to the card through the buffer cache */
+int readData(uint32_t address, char *buffer, int size)
 {
-    char tmp[SECTOR_SIZE];
+    struct buffer_head *bh;
     int idx, offset, toRead;
     do {
         idx = address / SECTOR_SIZE;
         offset = address % SECTOR_SIZE;
         toRead = MIN(SECTOR_SIZE - offset, size);
 
-        readblock(idx, tmp);
-        memcpy(buffer, tmp + offset, toRead);
+        if (!(bh = bread(idx))) {
+            return -E_IO;
+        }
+        memcpy(buffer, bh->b_data + offset, toRead);
+        brelse(bh);
 
         buffer += toRead;
         address += toRead;
         size -= toRead;
     } while (size > 0);
+    return 0;
 }
 
-void writeData(uint32_t address, char *buffer, int size)
+int writeData(uint32_t address, char *buffer, int size)
 {
-    char tmp[SECTOR_SIZE];
+    struct buffer_head *bh;
     int idx, offset, toWrite;
     do {
         idx = address / SECTOR_SIZE;
         offset = address % SECTOR_SIZE;
         toWrite = MIN(SECTOR_SIZE - offset, size);
 
-        readblock(idx, tmp);
-        memcpy(tmp + offset, buffer, toWrite);
-        writeblock(idx, tmp);
+        // a whole block is overwritten, no need to read it first
+        bh = (toWrite == SECTOR_SIZE) ? getblk(idx) : bread(idx);
+        if (!bh) {
+            return -E_IO;
+        }
+        memcpy(bh->b_data + offset, buffer, toWrite);
+        mark_buffer_dirty(bh);
+        brelse(bh);
 
         buffer += toWrite;
         address += toWrite;
         size -= toWrite;
     } while (size > 0);
+    return 0;
 }
 
 unsigned int nextCluster(unsigned int cluster)
@@ -212,8 +233,200 @@ unsigned int nextCluster(unsigned int cluster)
     /* Although FAT32 uses 32 bits per FAT entry, only the bottom 28 bits are
      * actually used to address clusters on the disk */
     uint32_t fatEntry;
-    readData(fatStart + (32 * cluster) / 8, (char *) &fatEntry,
-             sizeof(fatEntry));
+    if (readData(fatStart + (32 * cluster) / 8, (char *) &fatEntry,
+                 sizeof(fatEntry))) {
+        return FAT_LAST;
+    }
     fatEntry &= 0x0fffffff;
     return (fatEntry >= 0x0ffffff0) ? FAT_LAST : fatEntry;
 }
+
+static inline bool cluster_used(uint32_t cluster)
+{
+    return freeMap[cluster / 64] & (1ULL << (cluster % 64));
+}
+
+static inline void set_cluster_used(uint32_t cluster)
+{
+    freeMap[cluster / 64] |= (1ULL << (cluster % 64));
+}
+
+void fat_load_fsinfo()
+{
+    struct FSInfo info;
+
+    if (readData(fsInfoAddress, (char *) &info, sizeof(info)) ||
+        info.leadSignature != FSINFO_LEAD_SIG ||
+        info.signature != FSINFO_SIG ||
+        info.trailSignature != FSINFO_TRAIL_SIG) {
+        return;
+    }
+    // both fields are only hints, ignore values out of range
+    if (info.numFreeCluster <= clusterCount) {
+        freeCount = info.numFreeCluster;
+    }
+    if (info.clusterNumFreeCluster >= 2 &&
+        info.clusterNumFreeCluster < clusterCount + 2) {
+        nextFree = info.clusterNumFreeCluster;
+    }
+}
+
+/* write the free count and the next free hint back to FSInfo */
+void fat_sync_fsinfo()
+{
+    uint32_t hint[2] = {freeCount, nextFree};
+
+    if (!fsInfoDirty) {
+        return;
+    }
+    writeData(fsInfoAddress + offsetof(struct FSInfo, numFreeCluster),
+              (char *) hint, sizeof(hint));
+    fsInfoDirty = false;
+}
+
+static int build_free_map()
+{
+    uint32_t entries = clusterCount + 2, per_scan,
+             *fat = kmalloc(FAT_SCAN_BLOCKS * SECTOR_SIZE);
+
+    freeMap = kzalloc(ROUNDUP(entries, 64) / 8);
+    if (!fat || !freeMap) {
+        kfree(fat);
+        kfree(freeMap);
+        freeMap = NULL;
+        return -E_NO_MEM;
+    }
+
+    // scan the FAT a few sectors at a time, bypassing the buffer cache
+    per_scan = FAT_SCAN_BLOCKS * SECTOR_SIZE / sizeof(uint32_t);
+    freeCount = 0;
+    for (uint32_t base = 0; base < entries; base += per_scan) {
+        uint32_t n = MIN(per_scan, entries - base),
+                 blocks = ROUNDUP(n * sizeof(uint32_t), SECTOR_SIZE) /
+                          SECTOR_SIZE,
+                 block = (fatStart + base * sizeof(uint32_t)) / SECTOR_SIZE;
+        if (readblocks(block, blocks, fat)) {
+            kfree(fat);
+            kfree(freeMap);
+            freeMap = NULL;
+            return -E_IO;
+        }
+        buffer_copy_cached(block, blocks, fat);
+        for (uint32_t i = 0; i < n; i++) {
+            if (base + i < 2 || (fat[i] & 0x0fffffff)) {
+                set_cluster_used(base + i);
+            } else {
+                freeCount++;
+            }
+        }
+    }
+    kfree(fat);
+
+    if (nextFree == FSINFO_UNKNOWN) {
+        nextFree = 2;
+    }
+    fsInfoDirty = true;
+    return 0;
+}
+
+/*
+ * Find `want` free clusters in a row, starting the search at the next free
+ * hint. If no run is long enough, the longest run found is returned.
+ */
+static uint32_t find_free_run(uint32_t want, uint32_t *len)
+{
+    uint32_t best = 0, best_len = 0, start = 0, run = 0;
+
+    for (uint32_t i = 0; i < clusterCount; i++) {
+        uint32_t cluster = 2 + (nextFree - 2 + i) % clusterCount;
+        if (cluster == 2) {
+            run = 0;  // a run does not wrap around
+        }
+        if (cluster_used(cluster)) {
+            run = 0;
+            continue;
+        }
+        if (!run++) {
+            start = cluster;
+        }
+        if (run > best_len) {
+            best = start;
+            best_len = run;
+        }
+        if (run == want) {
+            break;
+        }
+    }
+    *len = best_len;
+    return best;
+}
+
+/*
+ * Allocate up to `want` contiguous clusters and link them after `prev` (0 if
+ * the chain is new). A file keeps growing in place if the cluster following
+ * `prev` is free. Return the number of clusters allocated, zero if the disk
+ * is full, otherwise a negative error number.
+ */
+int fat_alloc_clusters(uint32_t prev, uint32_t want, uint32_t *first)
+{
+    uint32_t entries[SECTOR_SIZE / sizeof(uint32_t)], start, len;
+    int ret;
+
+    if (!freeMap && (ret = build_free_map())) {
+        return ret;
+    }
+    if (!freeCount || !want) {
+        return 0;
+    }
+
+    if (prev && prev + 1 < clusterCount + 2 && !cluster_used(prev + 1)) {
+        start = prev + 1;
+        for (len = 0; len < want && start + len < clusterCount + 2 &&
+                      !cluster_used(start + len);
+             len++)
+            ;
+    } else {
+        start = find_free_run(want, &len);
+    }
+    if (!len) {
+        return 0;
+    }
+
+    // claim the run before the FAT I/O, another allocation may run while it
+    // sleeps on the card
+    for (uint32_t i = 0; i < len; i++) {
+        set_cluster_used(start + i);
+    }
+    freeCount -= len;
+    nextFree = (start + len < clusterCount + 2) ? start + len : 2;
+    fsInfoDirty = true;
+
+    // write the new chain, a sector of FAT entries at a time, keeping the
+    // reserved top 4 bits of each entry
+    for (uint32_t i = 0; i < len;) {
+        uint32_t n = MIN(len - i, sizeof(entries) / sizeof(uint32_t));
+        uint32_t addr = fatStart + (start + i) * sizeof(uint32_t);
+        if ((ret = readData(addr, (char *) entries, n * sizeof(uint32_t)))) {
+            return ret;
+        }
+        for (uint32_t j = 0; j < n; j++) {
+            entries[j] = (entries[j] & ~0x0fffffff) |
+                         ((i + j == len - 1) ? FAT_EOC : start + i + j + 1);
+        }
+        writeData(addr, (char *) entries, n * sizeof(uint32_t));
+        i += n;
+    }
+    if (prev) {
+        uint32_t link;
+        if ((ret = readData(fatStart + prev * sizeof(uint32_t), (char *) &link,
+                            sizeof(link)))) {
+            return ret;
+        }
+        link = (link & ~0x0fffffff) | start;
+        writeData(fatStart + prev * sizeof(uint32_t), (char *) &link,
+                  sizeof(link));
+    }
+
+    *first = start;
+    return len;
+}
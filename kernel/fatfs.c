@@ -9,8 +9,111 @@
 #include <include/mbr.h>
 #include <include/fat.h>
 #include <include/sd.h>
+#include <include/buffer.h>
+#include <include/blkdev.h>
+#include <include/pagecache.h>
+#include <include/uaccess.h>
 
 static int setup_vnode(struct vnode *node);
+static int fatfs_readpages(struct address_space *mapping,
+                           uint64_t index,
+                           uint32_t nr_pages);
+
+static int fatfs_writepage(struct address_space *mapping, page_t *pp);
+static int fatfs_sync_fs(struct super_block *sb);
+
+static const struct address_space_operations fatfs_aops = {
+    .readpages = fatfs_readpages,
+    .writepage = fatfs_writepage,
+};
+
+static const struct super_operations fatfs_super_ops = {
+    .sync_fs = fatfs_sync_fs,
+};
+
+static int fatfs_extent_append(fatfs_node_t *n, uint32_t disk_cluster)
+{
+    struct fat_extent *e = NULL;
+    uint32_t file_cluster = 0;
+
+    if (n->nr_extents) {
+        e = &n->extents[n->nr_extents - 1];
+        file_cluster = e->file_cluster + e->len;
+    }
+
+    if (e && e->disk_cluster + e->len == disk_cluster) {
+        e->len++;
+        return 0;
+    }
+
+    if (n->nr_extents == n->max_extents) {
+        uint32_t max =
+            n->max_extents ? n->max_extents << 1 : FATFS_INIT_EXTENTS;
+        struct fat_extent *extents = kmalloc(max * sizeof(struct fat_extent));
+        if (!extents) {
+            return -E_NO_MEM;
+        }
+        memcpy(extents, n->extents, n->nr_extents * sizeof(struct fat_extent));
+        kfree(n->extents);
+        n->extents = extents;
+        n->max_extents = max;
+    }
+
+    e = &n->extents[n->nr_extents++];
+    e->file_cluster = file_cluster;
+    e->disk_cluster = disk_cluster;
+    e->len = 1;
+    return 0;
+}
+
+/*
+ * Map the `index`-th cluster of a file to its cluster number, `run` gets the
+ * number of clusters stored contiguously from there. The FAT is only walked
+ * past the part of the chain mapped by earlier lookups, and sequential
+ * lookups are answered from the extent of the previous one.
+ */
+static int fatfs_bmap(fatfs_node_t *n, uint32_t index, uint32_t *run)
+{
+    struct fat_extent *e;
+    uint32_t lo, hi;
+
+    while (!n->nr_extents ||
+           index >= n->extents[n->nr_extents - 1].file_cluster +
+                        n->extents[n->nr_extents - 1].len) {
+        int next;
+        if (!n->nr_extents) {
+            next = n->cluster;
+        } else {
+            e = &n->extents[n->nr_extents - 1];
+            next = nextCluster(e->disk_cluster + e->len - 1);
+        }
+        if (next == FAT_LAST || next < 2 || fatfs_extent_append(n, next)) {
+            return FAT_LAST;
+        }
+    }
+
+    e = &n->extents[n->cursor];
+    if (index < e->file_cluster || index >= e->file_cluster + e->len) {
+        // find the last extent starting at or before `index`
+        lo = 0;
+        hi = n->nr_extents - 1;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi + 1) / 2;
+            if (n->extents[mid].file_cluster <= index) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        n->cursor = lo;
+        e = &n->extents[lo];
+    }
+
+    if (run) {
+        *run = e->len - (index - e->file_cluster);
+    }
+    return e->disk_cluster + (index - e->file_cluster);
+}
 
 static int v_lookup(dentry_t *dir,
                     dentry_t **target,
@@ -31,7 +134,7 @@ static int v_lookup(dentry_t *dir,
         struct list_head entry_list;
         struct fat_entry *pos, *tmp;
         fatfs_node_t *n = container_of(dir->inode, fatfs_node_t, inode);
-        readblock(clusterAddress(n->cluster, false) / SECTOR_SIZE, buffer);
+        readData(clusterAddress(n->cluster, false), buffer, bytesPerCluster);
         get_entries(buffer, bytesPerCluster, &entry_list);
 
         list_for_each_entry_safe(pos, tmp, &entry_list, head)
@@ -63,6 +166,7 @@ static int v_lookup(dentry_t *dir,
             n->inode.size = pos->size;
             n->inode.off = (pos->address - buffer);
             n->cluster = pos->cluster;
+            address_space_init(&n->mapping, &n->inode, &fatfs_aops);
             new->inode = (struct inode *) &n->inode;
 
             list_add_tail(&new->c_head, &dir->l_head);
@@ -93,118 +197,214 @@ static int v_create(dentry_t *dir_node,
     return -1;
 }
 
-static int f_write(file_t *file, const void *buf, size_t len)
+/*
+ * Write `len` bytes of `buf`, or zeros if `buf` is NULL, at `pos` of the file.
+ * The cluster chain is extended as needed. Return the number of bytes written,
+ * which is short if the disk is full or `buf` is a bad user buffer.
+ */
+static size_t fatfs_write_chain(fatfs_node_t *n,
+                                const void *buf,
+                                size_t len,
+                                size_t pos)
 {
-    fatfs_node_t *n =
-        container_of(file->dentry->inode, struct fatfs_node, inode);
-    int cluster = n->cluster, pre_cluster;
-    struct inode *i = &n->inode;
-    size_t begin_cluster = file->f_pos / bytesPerCluster,
-           offset = file->f_pos % bytesPerCluster;
-
-    // jump to where we want to write
-    for (int i = 0; i < begin_cluster && cluster != FAT_LAST; i++) {
-        cluster = nextCluster(cluster);
-    }
-    if (cluster == FAT_LAST) {
-        return 0;
+    static const uint8_t zeros[SECTOR_SIZE];
+    uint8_t data[SECTOR_SIZE];
+    size_t index = pos / bytesPerCluster, offset = pos % bytesPerCluster,
+           done = 0;
+    int cluster = fatfs_bmap(n, index, NULL), pre_cluster;
+    uint32_t first;
+
+    // `pos` is right past the last cluster of the chain
+    if (cluster == FAT_LAST && index > 0 &&
+        (pre_cluster = fatfs_bmap(n, index - 1, NULL)) != FAT_LAST &&
+        fat_alloc_clusters(pre_cluster,
+                           ROUNDUP(len, bytesPerCluster) / bytesPerCluster,
+                           &first) > 0) {
+        cluster = first;
     }
 
-    size_t write_count = len;
-    while (write_count > 0 && cluster != FAT_LAST) {
-        size_t count =
-            MIN(bytesPerCluster - offset, write_count);  // < 512 bytes
-        writeData(clusterAddress(cluster, false) + offset, (char *) buf, count);
+    while (done < len && cluster != FAT_LAST) {
+        // up to the end of a sector, copied in first since the user buffer
+        // may fault
+        size_t count = MIN(MIN(bytesPerCluster - offset, len - done),
+                           SECTOR_SIZE - offset % SECTOR_SIZE);
+        const void *src = zeros;
+        if (buf) {
+            if (copy_from_buf(data, buf + done, count)) {
+                break;
+            }
+            src = data;
+        }
+        if (writeData(clusterAddress(cluster, false) + offset, (char *) src,
+                      count)) {
+            break;
+        }
+        pagecache_update(n->inode.i_mapping, pos + done, src, count);
+        done += count;
+        if ((offset += count) < bytesPerCluster) {
+            continue;
+        }
         offset = 0;
-        buf += count;
-        write_count -= count;
         pre_cluster = cluster;
-        cluster = nextCluster(cluster);
-
-        // find a new cluster
-        if (cluster == FAT_LAST && write_count > 0) {
-            uint32_t fatEntry, addr;
-            unsigned int new_cluster = pre_cluster + 1;
-
-            while ((addr = fatStart + new_cluster * sizeof(fatEntry)) <
-                   dataStart) {
-                readData(addr, (char *) &fatEntry, sizeof(fatEntry));
-
-                if (fatEntry == 0x00000000) {
-                    // old FAT entry
-                    fatEntry = 0x0FFFFFFF & new_cluster;
-                    writeData(fatStart + pre_cluster * sizeof(fatEntry),
-                              (char *) &fatEntry, sizeof(fatEntry));
-                    // new FAT entry
-                    fatEntry = 0x0FFFFFF8;  // In use (end of chain)
-                    writeData(addr, (char *) &fatEntry, sizeof(fatEntry));
-                    cluster = new_cluster;
-                    break;
-                }
-
-                new_cluster++;
-            }
-
-            // no available FAT entry
-            if (addr >= dataStart) {
-                break;
+        cluster = fatfs_bmap(n, ++index, NULL);
+
+        // allocate clusters for the rest of the data in one run if possible
+        if (cluster == FAT_LAST && done < len) {
+            if (fat_alloc_clusters(pre_cluster,
+                                   ROUNDUP(len - done, bytesPerCluster) /
+                                       bytesPerCluster,
+                                   &first) <= 0) {
+                break;  // no free cluster
             }
+            cluster = first;
         }
     }
+    return done;
+}
 
-    file->f_pos += (len - write_count);
-    if (file->f_pos > i->size) {
-        i->size = file->f_pos;
-
-        // write new file size to the file's metadata
-        void *buffer = kmalloc(bytesPerCluster);
-        dentry_t *p_dentry = file->dentry->parent;
-        fatfs_node_t *p_node =
-            container_of(p_dentry->inode, fatfs_node_t, inode);
-        readblock(clusterAddress(p_node->cluster, false) / SECTOR_SIZE, buffer);
-        ((sfn_t *) (buffer + i->off))->size = i->size;
-        writeblock(clusterAddress(p_node->cluster, false) / SECTOR_SIZE,
-                   buffer);
-        kfree(buffer);
-    }
-    return (len - write_count);
+/* write new file size to the file's metadata */
+static void fatfs_update_size(dentry_t *dentry, size_t size)
+{
+    fatfs_node_t *p_node =
+        container_of(dentry->parent->inode, fatfs_node_t, inode);
+    uint32_t size32 = size;
+
+    dentry->inode->size = size;
+    writeData(clusterAddress(p_node->cluster, false) + dentry->inode->off +
+                  offsetof(sfn_t, size),
+              (char *) &size32, sizeof(size32));
 }
 
-static int f_read(file_t *file, void *buf, size_t len)
+static int f_write(file_t *file, const void *buf, size_t len, size_t *ppos)
 {
     fatfs_node_t *n =
         container_of(file->dentry->inode, struct fatfs_node, inode);
-    int cluster = n->cluster;
     struct inode *i = &n->inode;
-    size_t size = MIN(len, i->size - file->f_pos),
-           begin_cluster = file->f_pos / bytesPerCluster,
-           offset = file->f_pos % bytesPerCluster;
+    size_t pos = *ppos, count;
+
+    // FAT has no holes, the gap past the end of file is filled with zeros
+    if (pos > i->size) {
+        count = fatfs_write_chain(n, NULL, pos - i->size, i->size);
+        if (i->size + count < pos) {
+            if (count) {
+                fatfs_update_size(file->dentry, i->size + count);
+            }
+            return 0;
+        }
+    }
 
-    if (!size) {
-        return 0;
+    count = fatfs_write_chain(n, buf, len, pos);
+    *ppos = pos + count;
+    if (*ppos > i->size) {
+        fatfs_update_size(file->dentry, *ppos);
     }
+    return count;
+}
+
+static int f_read(file_t *file, void *buf, size_t len, size_t *ppos)
+{
+    return generic_file_read(file, buf, len, ppos);
+}
+
+/* write a page dirtied through a shared mapping, the file size is kept */
+static int fatfs_writepage(struct address_space *mapping, page_t *pp)
+{
+    fatfs_node_t *n = container_of(mapping->host, fatfs_node_t, inode);
+    size_t pos = pp->index << PAGE_SHIFT, len;
 
-    // jump to where we want to read
-    for (int i = 0; i < begin_cluster && cluster != FAT_LAST; i++) {
-        cluster = nextCluster(cluster);
+    if (pos >= mapping->host->size) {
+        return 0;  // truncated meanwhile
     }
-    if (cluster == FAT_LAST) {
-        return 0;
+    len = MIN(PAGE_SIZE, mapping->host->size - pos);
+    return fatfs_write_chain(n, page_address(pp), len, pos) == len ? 0 : -E_IO;
+}
+
+/*
+ * Fill pages of a file from its cluster chain. The sectors of all pages are
+ * submitted before the queue is run, so a readahead window stored in
+ * contiguous clusters is read by one command.
+ */
+static int fatfs_readpages(struct address_space *mapping,
+                           uint64_t index,
+                           uint32_t nr_pages)
+{
+    fatfs_node_t *n = container_of(mapping->host, fatfs_node_t, inode);
+    size_t size = mapping->host->size;
+    uint32_t max_bios = nr_pages * (PAGE_SIZE / SECTOR_SIZE), nr_bios = 0,
+             nr_ready = 0;
+    struct bio *bios;
+    page_t **pages;
+    int ret = 0;
+
+    bios = kmalloc(max_bios * sizeof(struct bio) + nr_pages * sizeof(page_t *));
+    if (!bios) {
+        return -E_NO_MEM;
     }
+    pages = (page_t **) (bios + max_bios);
 
-    size_t read_count = size;
-    while (read_count > 0 && cluster != FAT_LAST) {
-        size_t count =
-            MIN(bytesPerCluster - offset, read_count);  // < 512 bytes
-        readData(clusterAddress(cluster, false) + offset, buf, count);
-        offset = 0;
-        buf += count;
-        read_count -= count;
-        cluster = nextCluster(cluster);
+    for (uint64_t idx = index; idx < index + nr_pages && !ret; idx++) {
+        size_t begin = idx << PAGE_SHIFT, pos = begin,
+               end = MIN(begin + PAGE_SIZE, size);
+        page_t *pp;
+        char *dst;
+
+        if (begin >= size) {
+            break;
+        }
+        if (find_get_page(mapping, idx)) {
+            continue;
+        }
+        if (!(pp = grab_cache_page(mapping, idx))) {
+            ret = -E_NO_MEM;
+            break;
+        }
+
+        dst = page_address(pp);
+        while (pos < end) {
+            uint32_t run;
+            int cluster = fatfs_bmap(n, pos / bytesPerCluster, &run);
+            if (cluster == FAT_LAST) {
+                ret = -E_EOF;
+                break;
+            }
+
+            size_t offset = pos % bytesPerCluster,
+                   count = MIN(run * bytesPerCluster - offset, end - pos);
+            uint32_t block = (clusterAddress(cluster, false) + offset) /
+                             SECTOR_SIZE,
+                     nr_blocks = ROUNDUP(count, SECTOR_SIZE) / SECTOR_SIZE;
+            bio_init(&bios[nr_bios], REQ_READ, block, nr_blocks, dst);
+            blk_submit_bio(&bios[nr_bios++]);
+            dst += count;
+            pos += count;
+        }
+        if (!ret) {
+            pages[nr_ready++] = pp;
+        }
     }
 
-    file->f_pos += (size - read_count);
-    return (size - read_count);
+    blk_run_queue();
+    for (uint32_t i = 0; i < nr_bios; i++) {
+        if (blk_wait_bio(&bios[i])) {
+            ret = -E_IO;
+        }
+        buffer_copy_cached(bios[i].bi_sector, bios[i].bi_count,
+                           bios[i].bi_buf);
+    }
+    if (ret == -E_IO) {
+        nr_ready = 0;  // which page failed is unknown, leave all not up to date
+    }
+
+    for (uint32_t i = 0; i < nr_ready; i++) {
+        size_t len = MIN(size - (pages[i]->index << PAGE_SHIFT), PAGE_SIZE);
+        // bytes beyond the end of file in the last sector are not file data
+        if (len < PAGE_SIZE) {
+            memset(page_address(pages[i]) + len, 0, PAGE_SIZE - len);
+        }
+        pages[i]->flags |= PAGE_UPTODATE;
+    }
+    kfree(bios);
+    return ret;
 }
 
 static int fatfs_fill_super(struct super_block *sb, void *data)
@@ -215,11 +415,11 @@ static int fatfs_fill_super(struct super_block *sb, void *data)
     struct bios_parameter_block *bpb = &record.bpb;
     struct extended_bios_parameter_block *ebpb = &record.ebpb;
 
-    readblock(0, buffer);
-    if (parse_mbr((struct mbr *) buffer, &begin_sector)) {
+    if (readblock(0, buffer) ||
+        parse_mbr((struct mbr *) buffer, &begin_sector) ||
+        readblock(begin_sector, &record)) {
         return -1;
     }
-    readblock(begin_sector, &record);
 
     bytesPerSector = bpb->numBytesPerSector;
     sectorsPerCluster = bpb->numSectorsPerCluster;
@@ -229,6 +429,12 @@ static int fatfs_fill_super(struct super_block *sb, void *data)
                  bpb->numFats * ebpb->sectorsPerFat) *
                 bytesPerSector;
     fatStart = (begin_sector + bpb->numReservedSectors) * bytesPerSector;
+    fsInfoAddress = (begin_sector + ebpb->sectorNumFSInfo) * bytesPerSector;
+    clusterCount = ((bpb->numSectors ? bpb->numSectors : bpb->numLargeSectors) -
+                    bpb->numReservedSectors -
+                    bpb->numFats * ebpb->sectorsPerFat) /
+                   sectorsPerCluster;
+    fat_load_fsinfo();
 
     // create root directory entry
     dentry_t *root = (dentry_t *) kzalloc(sizeof(dentry_t));
@@ -246,14 +452,22 @@ static int fatfs_fill_super(struct super_block *sb, void *data)
     fatfs_node_t *n = (fatfs_node_t *) kzalloc(sizeof(fatfs_node_t));
     n->inode.size = 0;
     n->cluster = rootCluster;
+    address_space_init(&n->mapping, &n->inode, &fatfs_aops);
     root->inode = (struct inode *) &n->inode;
 
     // set up superblock
     sb->s_root = root;
+    sb->s_op = &fatfs_super_ops;
     INIT_LIST_HEAD(&sb->s_mounts);
     return 0;
 }
 
+static int fatfs_sync_fs(struct super_block *sb)
+{
+    fat_sync_fsinfo();
+    return 0;
+}
+
 static int setup_vnode(struct vnode *node)
 {
     node->v_ops =
@@ -0,0 +1,69 @@
+#include <include/image.h>
+#include <include/irq.h>
+#include <include/list.h>
+#include <include/pagecache.h>
+#include <include/slab.h>
+#include <include/string.h>
+#include <include/types.h>
+
+/*
+ * Page cache of the ELF images exec'ed, such as the embedded user program.
+ * A page of a read-only segment is copied out of the image on its first
+ * fault, the tasks executing the image map that copy afterwards. Images stay
+ * in kernel memory, so do their cached pages.
+ *
+ * Nothing tells where an image ends, so it is taken as the furthest byte its
+ * segments map. Every segment is mapped before the first fault, and the part
+ * of a page past that end is zeroed rather than copied from whatever kernel
+ * memory follows the image.
+ */
+
+static LIST_HEAD(images);
+
+/*
+ * Return the image at `start`, added on its first exec, or NULL. `size` bytes
+ * from `start` are part of it.
+ */
+struct exec_image *get_exec_image(kernaddr_t start, size_t size)
+{
+    struct exec_image *image;
+    uint64_t daif = irq_save();
+
+    list_for_each_entry(image, &images, list)
+    {
+        if (image->start == start) {
+            image->size = MAX(image->size, size);
+            irq_restore(daif);
+            return image;
+        }
+    }
+    if ((image = kzalloc(sizeof(*image)))) {
+        image->start = start;
+        image->size = size;
+        address_space_init(&image->mapping, NULL, NULL);
+        list_add(&image->list, &images);
+    }
+    irq_restore(daif);
+    return image;
+}
+
+/* return the page at file page `index` of `image`, NULL if out of memory */
+page_t *image_get_page(struct exec_image *image, uint64_t index)
+{
+    uint64_t offset = index << PAGE_SHIFT;
+    page_t *pp;
+
+    if ((pp = find_get_page(&image->mapping, index))) {
+        return pp;
+    }
+    if (!(pp = add_to_page_cache(&image->mapping, index))) {
+        return NULL;
+    }
+    // the page comes zeroed, only the bytes of the image are copied
+    if (offset < image->size) {
+        memcpy(page_address(pp), (void *) (image->start + offset),
+               MIN(PAGE_SIZE, image->size - offset));
+    }
+    pp->flags |= PAGE_UPTODATE;
+    return pp;
+}
@@ -3,6 +3,8 @@
 #include <include/peripherals/irq.h>
 #include <include/peripherals/timer.h>
 #include <include/peripherals/uart.h>
+#include <include/peripherals/dma.h>
+#include <include/sd.h>
 #include <include/kernel_log.h>
 #include <include/task.h>
 
@@ -16,6 +18,20 @@ void disable_irq()
     asm("msr daifset, #2");
 }
 
+/* mask IRQ and return the previous DAIF so nested sections restore it */
+uint64_t irq_save()
+{
+    uint64_t daif;
+    asm volatile("mrs %0, daif" : "=r"(daif) :);
+    disable_irq();
+    return daif;
+}
+
+void irq_restore(uint64_t daif)
+{
+    asm volatile("msr daif, %0" ::"r"(daif));
+}
+
 void gpu_irq_handler()
 {
     uint32_t gpu_irq1, gpu_irq2;
@@ -28,6 +44,9 @@ void gpu_irq_handler()
             case SYSTEM_TIMER_IRQ_1:
                 sys_timer_handler();
                 break;
+            case DMA_IRQ(DMA_CHANNEL_SD):
+                sd_dma_irq_handler();
+                break;
             default:
             }
         }
@@ -36,6 +55,9 @@ void gpu_irq_handler()
             case UART_IRQ:
                 uart_ret |= uart_handler();
                 break;
+            case SDHOST_IRQ:
+                sd_irq_handler();
+                break;
             default:
             }
         }
@@ -10,6 +10,10 @@
 #include <include/tmpfs.h>
 #include <include/fatfs.h>
 #include <include/sd.h>
+#include <include/buffer.h>
+#include <include/blkdev.h>
+#include <include/aio.h>
+#include <include/console.h>
 
 void init()
 {
@@ -30,16 +34,24 @@ void main()
     fb_showpicture();
     mem_init();
     sd_init();
+    blk_init();
+    buffer_init();
+    aio_init();
     tmpfs_init();
     fatfs_init();
     init_task();
     core_timer_enable();
 
     do_mount("tmpfs", "/", "tmpfs");
+    do_mkdir("/dev");
+    console_init();
     do_mkdir("/sdcard");
     do_mount("sdcard", "/sdcard", "fatfs");
 
     privilege_task_create(&zombie_reaper);
+    privilege_task_create(&bdflush);
+    privilege_task_create(&kblockd);
+    privilege_task_create(&kaiod);
     privilege_task_create(&init);
 
     enable_irq();
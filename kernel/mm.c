@@ -8,20 +8,22 @@
 #include <include/list.h>
 #include <include/kernel_log.h>
 #include <include/assert.h>
-#include <include/btree.h>
+#include <include/vmatree.h>
 #include <include/pgtable.h>
 #include <include/assert.h>
 #include <include/error.h>
 #include <include/tlbflush.h>
 #include <include/buddy.h>
 #include <include/slab.h>
+#include <include/vfs.h>
 
 static void page_free(page_t *pp);
-static void page_decref(page_t *);
 static int32_t __pud_alloc(mm_struct *, pgd_t *, virtaddr_t);
 static int32_t __pmd_alloc(mm_struct *, pud_t *, virtaddr_t);
 static int32_t __pte_alloc(mm_struct *, pmd_t *, virtaddr_t);
 static pte_t *walk_to_pte(mm_struct *, virtaddr_t);
+static int32_t unshare_pte_table(mm_struct *, pmd_t *, virtaddr_t);
+static int32_t split_huge_pmd(pmd_t *);
 static void free_pgtables(mm_struct *);
 static void mm_alloc_pgd(mm_struct *mm);
 static void pgtable_test();
@@ -190,8 +192,10 @@ void buddy_init()
     physaddr_t next_buddy_addr = KVA_TO_PA(nextfree);
     physaddr_t physical_mmio_addr = KVA_TO_PA(MMIO_BASE);
     while (next_buddy_addr < physical_mmio_addr) {
+        // blocks are aligned to their size, so that buddies are found by XOR
         uint8_t order = MIN(MAX_ORDER - 1,
                             buddy_order(physical_mmio_addr - next_buddy_addr));
+        order = MIN(order, __builtin_ctzll(PA_TO_PFN(next_buddy_addr)));
         page_t *pp = pa2page(next_buddy_addr);
         pp->order = order;
         add_page_to_free_list(pp, &buddy_system, order);
@@ -260,6 +264,9 @@ page_t *page_alloc()
         return NULL;
     free_page->refcnt = 0;
     free_page->page_slab = NULL;
+    free_page->flags = 0;
+    free_page->mapping = NULL;
+    free_page->index = 0;
     memset((void *) PA_TO_KVA(page2pa(free_page)), 0, PAGE_SIZE);
     return free_page;
 }
@@ -271,44 +278,69 @@ static void page_free(page_t *pp)
     buddy_free(pp);
 }
 
-static void page_decref(page_t *pp)
+void page_decref(page_t *pp)
 {
     if (--pp->refcnt == 0) {
         page_free(pp);
     }
 }
 
-static void mm_alloc_pgd(mm_struct *mm)
+/*
+ * A huge page is an order HPAGE_ORDER block whose first page holds the
+ * reference count. Splitting its mapping gives each of its pages the count,
+ * so that they are freed one by one from then on.
+ */
+static void huge_page_get(physaddr_t pa)
 {
-    if (!mm->pgd)
-        mm->pgd = pgd_alloc(mm);
+    page_t *head = pa2page(pa);
+
+    if (head->order == HPAGE_ORDER) {
+        head->refcnt++;
+        return;
+    }
+    for (size_t idx = 0; idx < HPAGE_SIZE / PAGE_SIZE; ++idx) {
+        head[idx].refcnt++;
+    }
 }
 
-static void free_pte(pte_t *pte_base)
+static void huge_page_put(physaddr_t pa)
 {
-    for (size_t idx = 0; idx < PAGE_SIZE / sizeof(pte_t); ++idx) {
-        pte_t *pte = pte_base + idx;
-        if (!pte_none(*pte)) {
-            page_t *pp = pa2page(__pte_to_phys(*pte));
-            page_decref(pp);
-            *pte = __pte(0);
-        }
-    }
+    page_t *head = pa2page(pa);
 
-    page_t *pp = pa2page(KVA_TO_PA((kernaddr_t) pte_base));
-    page_decref(pp);
+    if (head->order == HPAGE_ORDER) {
+        page_decref(head);
+        return;
+    }
+    for (size_t idx = 0; idx < HPAGE_SIZE / PAGE_SIZE; ++idx) {
+        page_decref(head + idx);
+    }
 }
 
-static void free_pmd(pmd_t *pmd_base)
+page_t *huge_page_alloc()
 {
-    for (size_t idx = 0; idx < PAGE_SIZE / sizeof(pmd_t); ++idx) {
-        pmd_t *pmd = pmd_base + idx;
-        if (!pmd_none(*pmd)) {
-            free_pte(pmd_pgtable(pmd));
-            *pmd = __pmd(0);
-        }
+    page_t *pp = buddy_alloc(HPAGE_ORDER);
+    if (!pp)
+        return NULL;
+    for (size_t idx = 0; idx < HPAGE_SIZE / PAGE_SIZE; ++idx) {
+        pp[idx].refcnt = 0;
+        pp[idx].page_slab = NULL;
+        pp[idx].flags = 0;
+        pp[idx].mapping = NULL;
+        pp[idx].index = 0;
     }
+    memset((void *) PA_TO_KVA(page2pa(pp)), 0, HPAGE_SIZE);
+    return pp;
+}
 
+static void mm_alloc_pgd(mm_struct *mm)
+{
+    if (!mm->pgd)
+        mm->pgd = pgd_alloc(mm);
+}
+
+/* the PTE tables are gone already, see free_pgtables() */
+static void free_pmd(pmd_t *pmd_base)
+{
     page_t *pp = pa2page(KVA_TO_PA((kernaddr_t) pmd_base));
     page_decref(pp);
 }
@@ -342,8 +374,15 @@ static void free_pgd(mm_struct *mm)
     mm->pgd = NULL;
 }
 
+/*
+ * Unmapping the whole user space drops the pages and the PTE tables, visiting
+ * only the tables present, what remains are the upper level tables.
+ */
 static void free_pgtables(mm_struct *mm)
 {
+    if (!mm->pgd)
+        return;
+    unmap_page_range(mm, 0, USER_VIRT_LIMIT);
     free_pgd(mm);
 }
 
@@ -366,13 +405,14 @@ page_t *pa2page(physaddr_t pa)
 void mm_init(mm_struct *mm)
 {
     mm_alloc_pgd(mm);
-    bt_init(&mm->mm_bt);
+    vt_init(&mm->mm_vt, 0, USER_VIRT_LIMIT);
+    mm->start_brk = mm->brk = 0;
 }
 
 void mm_destroy(mm_struct *mm)
 {
     free_pgtables(mm);
-    bt_destroy(&mm->mm_bt);
+    vt_destroy(&mm->mm_vt);
 }
 
 static int32_t __pud_alloc(mm_struct *mm, pgd_t *pgd, virtaddr_t address)
@@ -420,6 +460,80 @@ static int32_t __pte_alloc(mm_struct *mm, pmd_t *pmd, virtaddr_t address)
     return 0;
 }
 
+/*
+ * Give `mm` its own copy of the PTE table under `pmd`, which fork shared
+ * read-only with other tasks. Private pages writable in `mm` become
+ * copy-on-write in both copies. The last task sharing the table takes it over.
+ */
+static int32_t unshare_pte_table(mm_struct *mm, pmd_t *pmd, virtaddr_t addr)
+{
+    page_t *table = pa2page(__pmd_to_phys(*pmd)), *pp;
+    pte_t *old = pmd_pgtable(pmd), *new;
+    virtaddr_t base = ROUNDDOWN(addr, 1ULL << PMD_SHIFT);
+    struct vm_area_struct *vma;
+
+    if (table->refcnt == 1) {
+        *pmd = __pmd(pmd_val(*pmd) & ~PD_TABLE_RDONLY);
+        return 0;
+    }
+    if (!(pp = page_alloc())) {
+        return -E_NO_MEM;
+    }
+
+    new = (pte_t *) PA_TO_KVA(page2pa(pp));
+    for (size_t idx = 0; idx < PAGE_SIZE / sizeof(pte_t); ++idx) {
+        if (pte_none(old[idx])) {
+            continue;
+        }
+        pteval_t val = pte_val(old[idx]);
+        vma = vt_find(&mm->mm_vt, base + (idx << PTE_SHIFT));
+        if (vma && !(vma->vm_flags & VM_SHARED) &&
+            !(val & PD_ACCESS_PERM_2)) {
+            val |= PTE_COW | PD_ACCESS_PERM_2;  // RO
+            old[idx] = __pte(val);
+        }
+        new[idx] = __pte(val);
+        pa2page(__pte_to_phys(new[idx]))->refcnt++;
+    }
+
+    *pmd = __pmd((pmdval_t) page2pa(pp) | PMD_TYPE_TABLE);
+    pp->refcnt++;
+    page_decref(table);
+    return 0;
+}
+
+/*
+ * Map the huge page of the block entry `pmd` by a PTE table instead, the
+ * pages keep the attributes of the block.
+ */
+static int32_t split_huge_pmd(pmd_t *pmd)
+{
+    physaddr_t pa = __pmd_to_phys(*pmd);
+    pteval_t attr = (pmd_val(*pmd) & ~PTE_ADDR_MASK & ~PD_TABLE) | PD_PAGE;
+    page_t *head = pa2page(pa), *table = page_alloc();
+    pte_t *pte;
+
+    if (!table) {
+        return -E_NO_MEM;
+    }
+    pte = (pte_t *) PA_TO_KVA(page2pa(table));
+    for (size_t idx = 0; idx < HPAGE_SIZE / PAGE_SIZE; ++idx) {
+        pte[idx] = __pte((pa + (idx << PAGE_SHIFT)) | attr);
+    }
+
+    // the first task splitting a shared huge page splits the page itself
+    if (head->order == HPAGE_ORDER) {
+        for (size_t idx = 0; idx < HPAGE_SIZE / PAGE_SIZE; ++idx) {
+            head[idx].refcnt = head->refcnt;
+            head[idx].order = 0;
+        }
+    }
+
+    *pmd = __pmd((pmdval_t) page2pa(table) | PMD_TYPE_TABLE);
+    table->refcnt++;
+    return 0;
+}
+
 static pte_t *walk_to_pte(mm_struct *mm, virtaddr_t addr)
 {
     pgd_t *pgd;
@@ -436,11 +550,22 @@ static pte_t *walk_to_pte(mm_struct *mm, virtaddr_t addr)
     pmd = pmd_alloc(mm, pud, addr);
     if (!pmd)
         return NULL;
+    if (pmd_huge(*pmd) && split_huge_pmd(pmd))
+        return NULL;
+    if ((pmd_val(*pmd) & PD_TABLE_RDONLY) && unshare_pte_table(mm, pmd, addr))
+        return NULL;
     pte = pte_alloc(mm, pmd, addr);
 
     return pte;
 }
 
+/* map `pp` by the empty PTE `ptep` */
+void set_page_pte(pte_t *ptep, page_t *pp, pgprot_t prot)
+{
+    *ptep = __pte((pteval_t) page2pa(pp) | pgprot_val(prot) | PTE_NORMAL_ATTR);
+    pp->refcnt++;
+}
+
 int32_t insert_page(mm_struct *mm, page_t *pp, virtaddr_t addr, pgprot_t prot)
 {
     pte_t *pte = walk_to_pte(mm, addr);
@@ -449,12 +574,198 @@ int32_t insert_page(mm_struct *mm, page_t *pp, virtaddr_t addr, pgprot_t prot)
     if (!pte_none(*pte))
         return -E_BUSY;
 
-    *pte = __pte((pteval_t) page2pa(pp) | pgprot_val(prot) | PTE_NORMAL_ATTR);
+    set_page_pte(pte, pp, prot);
+
+    return 0;
+}
+
+/* map `pp`, from huge_page_alloc(), by one block at the 2 MB `addr` */
+int32_t insert_huge_page(mm_struct *mm,
+                         page_t *pp,
+                         virtaddr_t addr,
+                         pgprot_t prot)
+{
+    pgd_t *pgd;
+    pud_t *pud;
+    pmd_t *pmd;
+
+    if (!mm->pgd)
+        return -E_NO_MEM;
+    pgd = pgd_offset(mm, addr);
+    pud = pud_alloc(mm, pgd, addr);
+    if (!pud)
+        return -E_NO_MEM;
+    pmd = pmd_alloc(mm, pud, addr);
+    if (!pmd)
+        return -E_NO_MEM;
+    if (!pmd_none(*pmd))
+        return -E_BUSY;
+
+    *pmd = __pmd((pmdval_t) page2pa(pp) | pgprot_val(prot) | PMD_NORMAL_ATTR);
     pp->refcnt++;
 
     return 0;
 }
 
+static pmd_t *find_pmd(mm_struct *mm, virtaddr_t address)
+{
+    pgd_t *pgd;
+    pud_t *pud;
+
+    if (!mm->pgd)
+        return NULL;
+    pgd = pgd_offset(mm, address);
+    if (pgd_none(*pgd))
+        return NULL;
+    pud = pud_offset(pgd, address);
+    if (pud_none(*pud))
+        return NULL;
+    return pmd_offset(pud, address);
+}
+
+/* return the block entry mapping `address` by a huge page, or NULL */
+pmd_t *follow_huge_pmd(mm_struct *mm, virtaddr_t address)
+{
+    pmd_t *pmd = find_pmd(mm, address);
+
+    return (pmd && pmd_huge(*pmd)) ? pmd : NULL;
+}
+
+/* whether neither a block nor a PTE table maps the 2 MB around `address` */
+bool pmd_unused(mm_struct *mm, virtaddr_t address)
+{
+    pmd_t *pmd = find_pmd(mm, address);
+
+    return !pmd || pmd_none(*pmd);
+}
+
+/* end of the table entry of level `shift` mapping `addr`, or `end` */
+static inline virtaddr_t pgtable_addr_end(virtaddr_t addr,
+                                          virtaddr_t end,
+                                          uint32_t shift)
+{
+    virtaddr_t boundary = ROUNDDOWN(addr, 1ULL << shift) + (1ULL << shift);
+    return (boundary - 1 < end - 1) ? boundary : end;
+}
+
+static int32_t walk_pmd_range(pud_t *pud,
+                              virtaddr_t addr,
+                              virtaddr_t end,
+                              struct mm_walk *walk)
+{
+    pmd_t *pmd = pmd_offset(pud, addr);
+    virtaddr_t next;
+
+    for (; addr < end; ++pmd, addr = next) {
+        next = pgtable_addr_end(addr, end, PMD_SHIFT);
+        if (pmd_none(*pmd)) {
+            continue;
+        }
+        if (next - addr == HPAGE_SIZE && walk->pmd_entry &&
+            walk->pmd_entry(pmd, addr, walk)) {
+            continue;
+        }
+        if (pmd_huge(*pmd) && split_huge_pmd(pmd)) {
+            return -E_NO_MEM;
+        }
+        if ((pmd_val(*pmd) & PD_TABLE_RDONLY) &&
+            unshare_pte_table(walk->mm, pmd, addr)) {
+            return -E_NO_MEM;
+        }
+        walk->pte_range(pte_offset(pmd, addr), addr,
+                        (next - addr) >> PAGE_SHIFT, walk);
+    }
+    return 0;
+}
+
+static int32_t walk_pud_range(pgd_t *pgd,
+                              virtaddr_t addr,
+                              virtaddr_t end,
+                              struct mm_walk *walk)
+{
+    pud_t *pud = pud_offset(pgd, addr);
+    virtaddr_t next;
+    int32_t ret;
+
+    for (; addr < end; ++pud, addr = next) {
+        next = pgtable_addr_end(addr, end, PUD_SHIFT);
+        if (!pud_none(*pud) && (ret = walk_pmd_range(pud, addr, next, walk))) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Walk the page tables of [start, end), both page aligned, in walk->mm. Only
+ * the tables present are visited, each level once. A PMD entry mapping 2 MB
+ * of the range is given to walk->pmd_entry first. Otherwise a huge page is
+ * split, a PTE table shared since fork is unshared, and walk->pte_range gets
+ * the PTEs of the range in the table, present or not.
+ */
+int32_t walk_page_range(virtaddr_t start, virtaddr_t end, struct mm_walk *walk)
+{
+    mm_struct *mm = walk->mm;
+    virtaddr_t addr = start, next;
+    int32_t ret;
+
+    if (!mm->pgd)
+        return 0;
+    for (pgd_t *pgd = pgd_offset(mm, addr); addr < end; ++pgd, addr = next) {
+        next = pgtable_addr_end(addr, end, PGD_SHIFT);
+        if (!pgd_none(*pgd) && (ret = walk_pud_range(pgd, addr, next, walk))) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static void zap_pte_range(pte_t *ptep,
+                          virtaddr_t addr,
+                          size_t nr,
+                          struct mm_walk *walk)
+{
+    for (size_t idx = 0; idx < nr; ++idx) {
+        if (!pte_none(ptep[idx])) {
+            page_decref(pa2page(__pte_to_phys(ptep[idx])));
+            ptep[idx] = __pte(0);
+        }
+    }
+}
+
+/* drop a huge page or a whole PTE table, a table still shared is kept */
+static bool zap_pmd_entry(pmd_t *pmd, virtaddr_t addr, struct mm_walk *walk)
+{
+    page_t *table;
+
+    if (pmd_huge(*pmd)) {
+        huge_page_put(__pmd_to_phys(*pmd));
+    } else {
+        table = pa2page(__pmd_to_phys(*pmd));
+        if (table->refcnt == 1) {
+            zap_pte_range(pmd_pgtable(pmd), addr, PAGE_SIZE / sizeof(pte_t),
+                          walk);
+        }
+        page_decref(table);
+    }
+    *pmd = __pmd(0);
+    return true;
+}
+
+/*
+ * Drop the pages mapped in [start, end), the caller flushes the TLB. PTE
+ * tables covered by the range are freed too.
+ */
+int32_t unmap_page_range(mm_struct *mm, virtaddr_t start, virtaddr_t end)
+{
+    struct mm_walk walk = {
+        .mm = mm,
+        .pmd_entry = zap_pmd_entry,
+        .pte_range = zap_pte_range,
+    };
+    return walk_page_range(start, end, &walk);
+}
+
 int32_t follow_pte(mm_struct *mm, virtaddr_t address, pte_t **ptepp)
 {
     pgd_t *pgd;
@@ -479,6 +790,13 @@ int32_t follow_pte(mm_struct *mm, virtaddr_t address, pte_t **ptepp)
     if (pmd_none(*pmd)) {
         goto out;
     }
+    if (pmd_huge(*pmd) && split_huge_pmd(pmd)) {
+        goto out;
+    }
+    if ((pmd_val(*pmd) & PD_TABLE_RDONLY) &&
+        unshare_pte_table(mm, pmd, address)) {
+        goto out;
+    }
 
     ptep = pte_offset(pmd, address);
     if (pte_none(*ptep)) {
@@ -506,44 +824,92 @@ void unmap_page(mm_struct *mm, virtaddr_t addr)
     *pte = __pte(0);
 }
 
+/*
+ * Map every PTE table of `src` in `dst` as well. Both map them read-only
+ * until one of them writes below a table and gets its own copy of it. Huge
+ * pages are shared copy-on-write, a write splits the block in the writer.
+ */
+static int32_t share_pte_tables(mm_struct *dst, mm_struct *src)
+{
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(pgd_t); ++i) {
+        pgd_t *src_pgd = src->pgd + i;
+        if (pgd_none(*src_pgd)) {
+            continue;
+        }
+        for (size_t j = 0; j < PAGE_SIZE / sizeof(pud_t); ++j) {
+            pud_t *src_pud = pgd_pgtable(src_pgd) + j;
+            if (pud_none(*src_pud)) {
+                continue;
+            }
+            for (size_t k = 0; k < PAGE_SIZE / sizeof(pmd_t); ++k) {
+                pmd_t *src_pmd = pud_pgtable(src_pud) + k, *pmd;
+                pud_t *pud;
+                virtaddr_t va = ((virtaddr_t) i << PGD_SHIFT) |
+                                ((virtaddr_t) j << PUD_SHIFT) |
+                                ((virtaddr_t) k << PMD_SHIFT);
+                if (pmd_none(*src_pmd)) {
+                    continue;
+                }
+                if (!(pud = pud_alloc(dst, pgd_offset(dst, va), va)) ||
+                    !(pmd = pmd_alloc(dst, pud, va))) {
+                    return -E_NO_MEM;
+                }
+                if (pmd_huge(*src_pmd)) {
+                    // huge pages are private, writable ones become COW
+                    pmdval_t val = pmd_val(*src_pmd);
+                    if (!(val & PD_ACCESS_PERM_2)) {
+                        val |= PTE_COW | PD_ACCESS_PERM_2;
+                    }
+                    *src_pmd = *pmd = __pmd(val);
+                    huge_page_get(__pmd_to_phys(*src_pmd));
+                    continue;
+                }
+                *src_pmd = __pmd(pmd_val(*src_pmd) | PD_TABLE_RDONLY);
+                *pmd = *src_pmd;
+                pa2page(__pmd_to_phys(*src_pmd))->refcnt++;
+            }
+        }
+    }
+    return 0;
+}
+
 void copy_mm(mm_struct *dst, const mm_struct *src)
 {
-    b_key *key;
-    bt_for_each(&src->mm_bt, key)
+    struct vm_area_struct *vma;
+
+    dst->start_brk = src->start_brk;
+    dst->brk = src->brk;
+    vt_for_each(&src->mm_vt, vma)
     {
-        if (is_minimum(key) || is_maximum(key))
-            continue;
+        struct vm_area_struct *new_vma = vma_alloc();
+        if (new_vma == NULL) {
+            panic("vma_alloc error");
+        }
 
-        struct vm_area_struct *new_vma = NULL;
-        if (key->entry) {
-            struct vm_area_struct *vma = key->entry;
-            new_vma = vma_alloc();
-            if (new_vma == NULL) {
+        new_vma->vm_start = vma->vm_start;
+        new_vma->vm_end = vma->vm_end;
+        new_vma->vm_mm = dst;
+        new_vma->vm_page_prot = vma->vm_page_prot;
+        new_vma->vm_file_start = vma->vm_file_start;
+        new_vma->vm_file_offset = vma->vm_file_offset;
+        new_vma->vm_file_len = vma->vm_file_len;
+        new_vma->vm_file = NULL;
+        new_vma->vm_pgoff = vma->vm_pgoff;
+        new_vma->vm_flags = vma->vm_flags;
+        new_vma->vm_image = vma->vm_image;
+        if (vma->vm_file) {
+            if (!(new_vma->vm_file = kmalloc(sizeof(file_t)))) {
                 panic("vma_alloc error");
             }
-
-            new_vma->vm_start = vma->vm_start;
-            new_vma->vm_end = vma->vm_end;
-            new_vma->vm_mm = dst;
-            new_vma->vm_page_prot = vma->vm_page_prot;
-            new_vma->vm_file_start = vma->vm_file_start;
-            new_vma->vm_file_offset = vma->vm_file_offset;
-            new_vma->vm_file_len = vma->vm_file_len;
-
-            pte_t *ptep;
-            for (virtaddr_t va = key->start; va < key->end; va += PAGE_SIZE) {
-                if (follow_pte((mm_struct *) src, va, &ptep) == 0) {
-                    *ptep = __pte(pte_val(*ptep) | PD_ACCESS_PERM_3);  // RO
-                    page_t *pp = pa2page(__pte_to_phys(*ptep));
-                    insert_page(dst, pp, va,
-                                __pgprot(pgprot_val(vma->vm_page_prot) |
-                                         PD_ACCESS_PERM_3));  // RO
-                }
-            }
+            *new_vma->vm_file = *vma->vm_file;
         }
 
-        bt_insert_range(&dst->mm_bt.root, key->start, key->end,
-                        (void *) new_vma);
+        // same order as the source, the insertion cannot fail
+        vt_insert(&dst->mm_vt, new_vma);
+    }
+
+    if (share_pte_tables(dst, (mm_struct *) src)) {
+        panic("share_pte_tables error");
     }
 }
 
@@ -558,6 +924,7 @@ void vma_free(struct vm_area_struct *vma)
 {
     if (!vma)
         return;
+    kfree(vma->vm_file);
     kfree(vma);
 }
 
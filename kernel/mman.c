@@ -4,32 +4,18 @@
 #include <include/kernel_log.h>
 #include <include/task.h>
 #include <include/string.h>
-#include <include/btree.h>
+#include <include/vmatree.h>
 #include <include/error.h>
+#include <include/image.h>
+#include <include/pagecache.h>
+#include <include/pgtable.h>
+#include <include/slab.h>
+#include <include/tlbflush.h>
+#include <include/vfs.h>
 
-void *do_mmap(void *addr,
-              size_t len,
-              mmap_prot_t prot,
-              mmap_flags_t flags,
-              void *file_start,
-              off_t file_offset)
+/* page attributes of a mapping with protection `prot` */
+static pgprot_t vm_get_page_prot(mmap_prot_t prot)
 {
-    task_t *cur = (task_t *) get_current();
-    btree *bt = &cur->mm.mm_bt;
-
-    if (flags & MAP_FIXED) {
-        if ((virtaddr_t) addr & ((1ull << PAGE_SHIFT) - 1)) {
-            return MAP_FAILED;
-        }
-    }
-
-    uint64_t start =
-        (addr == NULL) ? bt->min : (uint64_t) ROUNDDOWN(addr, PAGE_SIZE);
-    if (!bt_find_empty_area(bt->root, start, bt->max, ROUNDUP(len, PAGE_SIZE),
-                            (uint64_t *) &addr)) {
-        return MAP_FAILED;
-    }
-
     pgprot_t attr = __pgprot(PD_ACCESS_PERM_0);
     if (prot & PROT_READ) {
         if (prot & PROT_WRITE) {
@@ -41,31 +27,808 @@ void *do_mmap(void *addr,
     if (!(prot & PROT_EXEC)) {
         pgprot_val(attr) |= PD_ACCESS_EXEC;
     }
+    return attr;
+}
+
+/*
+ * Find a free range and insert a VMA without backing for it. A MAP_FIXED
+ * request fails rather than moving when `addr` is not free.
+ */
+static struct vm_area_struct *mmap_region(void *addr,
+                                          size_t len,
+                                          mmap_prot_t prot,
+                                          mmap_flags_t flags)
+{
+    task_t *cur = (task_t *) get_current();
+    struct vma_tree *vt = &cur->mm.mm_vt;
+
+    if (flags & MAP_FIXED) {
+        if ((virtaddr_t) addr & ((1ull << PAGE_SHIFT) - 1)) {
+            return NULL;
+        }
+    }
+
+    virtaddr_t start =
+        (addr == NULL) ? vt->min : (virtaddr_t) ROUNDDOWN(addr, PAGE_SIZE);
+    // a large mapping is placed so that huge pages can map it
+    size_t slack = (!(flags & MAP_FIXED) && len >= HPAGE_SIZE)
+                       ? HPAGE_SIZE - PAGE_SIZE
+                       : 0;
+    if (vt_find_gap(vt, start, vt->max, ROUNDUP(len, PAGE_SIZE) + slack,
+                    (virtaddr_t *) &addr)) {
+        return NULL;
+    }
+    if ((flags & MAP_FIXED) && (virtaddr_t) addr != start) {
+        return NULL;
+    }
+    if (slack) {
+        addr = (void *) ROUNDUP((virtaddr_t) addr, HPAGE_SIZE);
+    }
 
+    pgprot_t attr = vm_get_page_prot(prot);
     virtaddr_t first = (virtaddr_t) addr;
-    virtaddr_t last = (virtaddr_t) addr + len;
+    virtaddr_t last = (virtaddr_t) addr + ROUNDUP(len, PAGE_SIZE);
 
     struct vm_area_struct *vma = vma_alloc();
     if (vma == NULL) {
-        return MAP_FAILED;
+        return NULL;
     }
 
     vma->vm_start = first;
     vma->vm_end = last;
     vma->vm_mm = &cur->mm;
     vma->vm_page_prot = attr;
+    vma->vm_file_start = (kernaddr_t) NULL;
+    vma->vm_file_offset = 0;
+    vma->vm_file_len = 0;
+    vma->vm_file = NULL;
+    vma->vm_pgoff = 0;
+    vma->vm_flags = 0;
+    vma->vm_image = NULL;
+
+    if (vt_insert(vt, vma) != 0) {
+        vma_free(vma);
+        return NULL;
+    }
+
+    KERNEL_LOG_DEBUG("do_mmap: address 0x%x, length %d", addr, len);
+
+    return vma;
+}
+
+/* fault every page of a new mapping in, so that using it traps no more */
+static void populate_vma(struct vm_area_struct *vma)
+{
+    pte_t *ptep;
+
+    for (virtaddr_t va = vma->vm_start; va < vma->vm_end; va += PAGE_SIZE) {
+        if (follow_huge_pmd(vma->vm_mm, va)) {
+            va = ROUNDDOWN(va, HPAGE_SIZE) + HPAGE_SIZE - PAGE_SIZE;
+            continue;
+        }
+        if (follow_pte(vma->vm_mm, va, &ptep) != 0 &&
+            handle_mm_fault(vma->vm_mm, vma, va, false)) {
+            break;
+        }
+    }
+    flush_tlb_all();
+}
+
+/* map anonymous memory, or a copy of kernel memory at `file_start` */
+void *do_mmap(void *addr,
+              size_t len,
+              mmap_prot_t prot,
+              mmap_flags_t flags,
+              void *file_start,
+              off_t file_offset)
+{
+    struct vm_area_struct *vma = mmap_region(addr, len, prot, flags);
+    if (!vma) {
+        return MAP_FAILED;
+    }
+
     vma->vm_file_start = (kernaddr_t) file_start;
     vma->vm_file_offset = file_offset;
     vma->vm_file_len = len;
+    if (flags & MAP_POPULATE) {
+        populate_vma(vma);
+    }
+    return (void *) vma->vm_start;
+}
 
-    if (bt_insert_range(&bt->root, (uint64_t) addr,
-                        (uint64_t) addr + ROUNDUP(len, PAGE_SIZE),
-                        (void *) vma) != 0) {
-        vma_free(vma);
+/*
+ * Map `len` bytes of the ELF image at `bin_start` at the fixed `addr`, from
+ * the page aligned `offset`. Only the first `filesz` bytes come from the
+ * image, the others read as zero. A read-only mapping without zeroed bytes
+ * maps the pages the image shares with every task executing it.
+ */
+void *do_mmap_image(void *addr,
+                    size_t len,
+                    mmap_prot_t prot,
+                    void *bin_start,
+                    off_t offset,
+                    size_t filesz)
+{
+    struct vm_area_struct *vma =
+        mmap_region(addr, len, prot, MAP_FIXED | MAP_PRIVATE);
+    if (!vma) {
+        return MAP_FAILED;
+    }
+
+    vma->vm_file_start = (kernaddr_t) bin_start;
+    vma->vm_file_offset = offset;
+    vma->vm_file_len = filesz;
+    if (!(prot & PROT_WRITE) && filesz >= len) {
+        vma->vm_image = get_exec_image((kernaddr_t) bin_start, offset + filesz);
+    }
+    return (void *) vma->vm_start;
+}
+
+/*
+ * Map `file` from `offset`, which must be page aligned. Pages are taken from
+ * the page cache of the file when touched. A MAP_SHARED mapping maps the
+ * cached pages themselves, a MAP_PRIVATE one copies a page on its first
+ * write.
+ */
+void *do_mmap_file(void *addr,
+                   size_t len,
+                   mmap_prot_t prot,
+                   mmap_flags_t flags,
+                   file_t *file,
+                   off_t offset)
+{
+    struct vm_area_struct *vma;
+    file_t *copy;
+
+    if (!file || file->dentry->flag != FILE ||
+        !file->dentry->inode->i_mapping || offset < 0 ||
+        (offset & ~PAGE_MASK) ||
+        !(flags & MAP_SHARED) == !(flags & MAP_PRIVATE)) {
+        return MAP_FAILED;
+    }
+    if (!(copy = kzalloc(sizeof(file_t)))) {
+        return MAP_FAILED;
+    }
+    copy->dentry = file->dentry;
+
+    if (!(vma = mmap_region(addr, len, prot, flags))) {
+        kfree(copy);
+        return MAP_FAILED;
+    }
+    vma->vm_file = copy;
+    vma->vm_pgoff = (uint64_t) offset >> PAGE_SHIFT;
+    vma->vm_flags = (flags & MAP_SHARED) ? VM_SHARED : 0;
+    if (flags & MAP_POPULATE) {
+        populate_vma(vma);
+    }
+    return (void *) vma->vm_start;
+}
+
+/*
+ * Map the kernel page `pp` into the current task, for memory the kernel and
+ * the task share. The mapping is VM_SHARED so that fork does not copy the
+ * page on write, the kernel keeps its own reference to `pp`.
+ */
+void *do_mmap_kernel_page(page_t *pp, mmap_prot_t prot)
+{
+    task_t *cur = (task_t *) get_current();
+    struct vm_area_struct *vma = mmap_region(NULL, PAGE_SIZE, prot, 0);
+
+    if (!vma) {
         return MAP_FAILED;
     }
+    vma->vm_flags = VM_SHARED;
+    if (insert_page(&cur->mm, pp, vma->vm_start, vma->vm_page_prot)) {
+        do_munmap((void *) vma->vm_start, PAGE_SIZE);
+        return MAP_FAILED;
+    }
+    return (void *) vma->vm_start;
+}
+
+/*
+ * Resolve a fault at `va` of a file mapping. Read faults map the cached page
+ * read-only. A write to a shared mapping marks the page dirty and maps it
+ * writable, a write to a private mapping maps a copy of the page.
+ */
+int32_t filemap_fault(mm_struct *mm,
+                      struct vm_area_struct *vma,
+                      virtaddr_t va,
+                      bool write)
+{
+    pgprot_t prot = vma->vm_page_prot,
+             prot_ro = __pgprot(pgprot_val(prot) | PD_ACCESS_PERM_3);
+    uint64_t index = vma->vm_pgoff + ((va - vma->vm_start) >> PAGE_SHIFT);
+    page_t *pp, *new;
+    pte_t *ptep;
+
+    if (follow_pte(mm, va, &ptep) == 0) {
+        // write to a present read-only page
+        pp = pa2page(__pte_to_phys(*ptep));
+        if (vma->vm_flags & VM_SHARED) {
+            pp->flags |= PAGE_DIRTY;
+            *ptep = __pte((pteval_t) page2pa(pp) | pgprot_val(prot) |
+                          PTE_NORMAL_ATTR);
+            return 0;
+        }
+        if (!(new = page_alloc())) {
+            return -E_NO_MEM;
+        }
+        memcpy(page_address(new), page_address(pp), PAGE_SIZE);
+        unmap_page(mm, va);
+        return insert_page(mm, new, va, prot);
+    }
+
+    pp = read_cache_page(vma->vm_file->dentry->inode->i_mapping,
+                         &vma->vm_file->f_ra, index);
+    if (!pp) {
+        return -E_FAULT;  // past the end of file or I/O error
+    }
+
+    if (vma->vm_flags & VM_SHARED) {
+        if (write) {
+            pp->flags |= PAGE_DIRTY;
+        }
+        return insert_page(mm, pp, va, write ? prot : prot_ro);
+    }
+    if (!write) {
+        return insert_page(mm, pp, va, prot_ro);
+    }
+    if (!(new = page_alloc())) {
+        return -E_NO_MEM;
+    }
+    memcpy(page_address(new), page_address(pp), PAGE_SIZE);
+    return insert_page(mm, new, va, prot);
+}
+
+/*
+ * Fault of a read-only ELF segment, mapping the page the image shares with
+ * every task executing it. A write, possible once the segment is made
+ * writable, maps a copy of the page.
+ */
+static int32_t image_fault(mm_struct *mm,
+                           struct vm_area_struct *vma,
+                           virtaddr_t va,
+                           bool write)
+{
+    pgprot_t prot = vma->vm_page_prot,
+             prot_ro = __pgprot(pgprot_val(prot) | PD_ACCESS_PERM_3);
+    uint64_t index = (vma->vm_file_offset + (va - vma->vm_start)) >> PAGE_SHIFT;
+    page_t *pp, *new;
+    pte_t *ptep;
+
+    if (follow_pte(mm, va, &ptep) == 0) {
+        // write to the shared page
+        pp = pa2page(__pte_to_phys(*ptep));
+    } else if (!(pp = image_get_page(vma->vm_image, index))) {
+        return -E_NO_MEM;
+    } else if (!write) {
+        return insert_page(mm, pp, va, prot_ro);
+    }
+
+    if (!(new = page_alloc())) {
+        return -E_NO_MEM;
+    }
+    memcpy(page_address(new), page_address(pp), PAGE_SIZE);
+    unmap_page(mm, va);
+    return insert_page(mm, new, va, prot);
+}
+
+/* copy the page at `va` of the kernel memory backing `vma` into `pp` */
+static void copy_backing_page(struct vm_area_struct *vma,
+                              virtaddr_t va,
+                              page_t *pp)
+{
+    size_t off = va - vma->vm_start;
+
+    if (off < vma->vm_file_len) {
+        memcpy(page_address(pp),
+               (void *) (vma->vm_file_start + vma->vm_file_offset + off),
+               MIN(PAGE_SIZE, vma->vm_file_len - off));
+    }
+}
+
+/* fault of a mapping without file, a write to a shared page copies it */
+static int32_t anon_fault(mm_struct *mm,
+                          struct vm_area_struct *vma,
+                          virtaddr_t va)
+{
+    page_t *pp = page_alloc();
+    pte_t *ptep;
+
+    if (!pp) {
+        return -E_NO_MEM;
+    }
+    if (follow_pte(mm, va, &ptep) == 0) {
+        // copy on write
+        memcpy(page_address(pp), (void *) PA_TO_KVA(__pte_to_phys(*ptep)),
+               PAGE_SIZE);
+        unmap_page(mm, va);
+    } else if (vma->vm_file_start != (kernaddr_t) NULL) {
+        // demand paging
+        copy_backing_page(vma, va, pp);
+    }
+    return insert_page(mm, pp, va, vma->vm_page_prot);
+}
+
+/*
+ * Map the 2 MB around `va` by one huge page when the VMA covers all of it and
+ * nothing is mapped there yet, so that it takes one fault and one TLB entry.
+ */
+static int32_t huge_anon_fault(mm_struct *mm,
+                               struct vm_area_struct *vma,
+                               virtaddr_t va)
+{
+    virtaddr_t haddr = ROUNDDOWN(va, HPAGE_SIZE);
+    page_t *pp;
+    int32_t ret;
+
+    if ((vma->vm_flags & VM_NOHUGEPAGE) || haddr < vma->vm_start ||
+        haddr + HPAGE_SIZE > vma->vm_end || !pmd_unused(mm, haddr)) {
+        return -E_INVAL;
+    }
+    if (!(pp = huge_page_alloc())) {
+        return -E_NO_MEM;
+    }
+    pp->refcnt++;
+    ret = insert_huge_page(mm, pp, haddr, vma->vm_page_prot);
+    page_decref(pp);
+    return ret;
+}
+
+/*
+ * Write fault on a page shared copy-on-write. The last task mapping the page
+ * takes it over, the others write to a copy.
+ */
+static int32_t do_wp_page(mm_struct *mm,
+                          struct vm_area_struct *vma,
+                          virtaddr_t va,
+                          pte_t *ptep)
+{
+    page_t *pp = pa2page(__pte_to_phys(*ptep)), *new;
+    pteval_t val = pte_val(*ptep);
+
+    if (pp->refcnt == 1) {
+        *ptep = __pte((val & ~(PD_ACCESS_PERM_3 | PTE_COW)) |
+                      (pgprot_val(vma->vm_page_prot) & PD_ACCESS_PERM_3));
+        return 0;
+    }
+    if (!(new = page_alloc())) {
+        return -E_NO_MEM;
+    }
+    memcpy(page_address(new), page_address(pp), PAGE_SIZE);
+    unmap_page(mm, va);
+    return insert_page(mm, new, va, vma->vm_page_prot);
+}
+
+static void fault_around_pte_range(pte_t *ptep,
+                                   virtaddr_t addr,
+                                   size_t nr,
+                                   struct mm_walk *walk)
+{
+    struct vm_area_struct *vma = walk->private;
+    pgprot_t prot_ro =
+        __pgprot(pgprot_val(vma->vm_page_prot) | PD_ACCESS_PERM_3);
+    page_t *pp;
+
+    for (size_t idx = 0; idx < nr; ++idx, addr += PAGE_SIZE) {
+        if (!pte_none(ptep[idx])) {
+            continue;
+        }
+        if (vma->vm_file) {
+            uint64_t index =
+                vma->vm_pgoff + ((addr - vma->vm_start) >> PAGE_SHIFT);
+            if ((pp = find_get_page(vma->vm_file->dentry->inode->i_mapping,
+                                    index))) {
+                set_page_pte(ptep + idx, pp, prot_ro);
+            }
+        } else if (vma->vm_image) {
+            uint64_t index = (vma->vm_file_offset + (addr - vma->vm_start)) >>
+                             PAGE_SHIFT;
+            if (!(pp = image_get_page(vma->vm_image, index))) {
+                return;
+            }
+            set_page_pte(ptep + idx, pp, prot_ro);
+        } else {
+            if (!(pp = page_alloc())) {
+                return;
+            }
+            copy_backing_page(vma, addr, pp);
+            set_page_pte(ptep + idx, pp, vma->vm_page_prot);
+        }
+    }
+}
+
+/*
+ * Map the pages around `va` that are available without I/O: pages of the
+ * kernel memory backing the VMA, such as the embedded user image, or pages of
+ * the file already in the page cache. The window lies in the PTE table the
+ * fault just filled, which is walked once.
+ */
+static void do_fault_around(mm_struct *mm,
+                            struct vm_area_struct *vma,
+                            virtaddr_t va)
+{
+    const size_t window = FAULT_AROUND_PAGES * PAGE_SIZE;
+    virtaddr_t start = MAX(ROUNDDOWN(va, window), vma->vm_start),
+               end = MIN(ROUNDDOWN(va, window) + window,
+                         ROUNDUP(vma->vm_end, PAGE_SIZE));
+    struct mm_walk walk = {
+        .mm = mm,
+        .pte_range = fault_around_pte_range,
+        .private = vma,
+    };
+
+    walk_page_range(start, end, &walk);
+}
+
+/*
+ * Resolve a fault at `va` of `vma`, the caller checked the access and
+ * flushes the TLB. A fault on a page not present also maps its neighbours
+ * when that needs no I/O.
+ */
+int32_t handle_mm_fault(mm_struct *mm,
+                        struct vm_area_struct *vma,
+                        virtaddr_t va,
+                        bool write)
+{
+    pte_t *ptep;
+    bool present = (follow_pte(mm, va, &ptep) == 0);
+    int32_t ret;
+
+    if (present && write && (pte_val(*ptep) & PTE_COW)) {
+        return do_wp_page(mm, vma, va, ptep);
+    }
+    // write below a table shared at fork, follow_pte() unshared it
+    if (present && !(pte_val(*ptep) & (PTE_COW | PD_ACCESS_PERM_2))) {
+        return 0;
+    }
+    // fall back to a page when no huge page fits or is free
+    if (!present && !vma->vm_file && !vma->vm_file_start &&
+        huge_anon_fault(mm, vma, va) == 0) {
+        return 0;
+    }
+    if (vma->vm_file) {
+        ret = filemap_fault(mm, vma, va, write);
+    } else if (vma->vm_image) {
+        ret = image_fault(mm, vma, va, write);
+    } else {
+        ret = anon_fault(mm, vma, va);
+    }
+
+    if (!ret && !present &&
+        (vma->vm_file || vma->vm_file_start != (kernaddr_t) NULL)) {
+        do_fault_around(mm, vma, va);
+    }
+    return ret;
+}
+
+/*
+ * Write back the dirty pages of the file mapped at `addr`, and map the pages
+ * of the range read-only again so that later writes dirty them again.
+ */
+int32_t do_msync(void *addr, size_t len, int32_t flags)
+{
+    task_t *cur = (task_t *) get_current();
+    struct vm_area_struct *vma;
+    virtaddr_t start = (virtaddr_t) addr, end;
+    pte_t *ptep;
+    int32_t ret;
+
+    if (start & ~PAGE_MASK) {
+        return -1;
+    }
+    if (!(vma = vt_find(&cur->mm.mm_vt, start))) {
+        return -1;
+    }
+    if (!vma->vm_file || !(vma->vm_flags & VM_SHARED)) {
+        return 0;
+    }
+
+    end = MIN(start + ROUNDUP(len, PAGE_SIZE), vma->vm_end);
+    for (virtaddr_t va = start; va < end; va += PAGE_SIZE) {
+        if (follow_pte(&cur->mm, va, &ptep) == 0) {
+            // AP[2] only, a PROT_NONE page must stay out of EL0's reach
+            *ptep = __pte(pte_val(*ptep) | PD_ACCESS_PERM_2);
+        }
+    }
+    flush_tlb_all();
+
+    ret = filemap_fdatawrite(vma->vm_file->dentry->inode->i_mapping);
+    return ret ? -1 : 0;
+}
+
+/* move the start of `vma` forward to `addr`, the backing stays in place */
+static void vma_adjust_start(struct vm_area_struct *vma, virtaddr_t addr)
+{
+    size_t delta = addr - vma->vm_start;
+
+    vma->vm_start = addr;
+    vma->vm_file_offset += delta;
+    vma->vm_file_len = vma->vm_file_len > delta ? vma->vm_file_len - delta : 0;
+    vma->vm_pgoff += delta >> PAGE_SHIFT;
+}
+
+/* split `vma` at `addr`, the part from `addr` becomes a new VMA */
+static int32_t split_vma(mm_struct *mm,
+                         struct vm_area_struct *vma,
+                         virtaddr_t addr)
+{
+    struct vm_area_struct *new;
+
+    if (!(new = vma_alloc())) {
+        return -E_NO_MEM;
+    }
+    *new = *vma;
+    if (vma->vm_file) {
+        if (!(new->vm_file = kmalloc(sizeof(file_t)))) {
+            kfree(new);
+            return -E_NO_MEM;
+        }
+        *new->vm_file = *vma->vm_file;
+    }
+    vma_adjust_start(new, addr);
+
+    vma->vm_end = addr;
+    vt_update(&mm->mm_vt, vma);
+    vt_insert(&mm->mm_vt, new);
+    return 0;
+}
+
+/* return the lowest VMA overlapping [start, end), or NULL */
+static struct vm_area_struct *find_vma_intersection(mm_struct *mm,
+                                                    virtaddr_t start,
+                                                    virtaddr_t end)
+{
+    struct vm_area_struct *vma = vt_find_above(&mm->mm_vt, start);
+
+    return (vma && vma->vm_start < end) ? vma : NULL;
+}
+
+/* remove the mappings of [addr, addr + len), a VMA partly in it is split */
+int32_t do_munmap(void *addr, size_t len)
+{
+    task_t *cur = (task_t *) get_current();
+    mm_struct *mm = &cur->mm;
+    virtaddr_t start = (virtaddr_t) addr,
+               end = start + ROUNDUP(len, PAGE_SIZE);
+    struct vm_area_struct *vma;
+
+    if ((start & ~PAGE_MASK) || !len || end <= start) {
+        return -1;
+    }
+
+    while ((vma = find_vma_intersection(mm, start, end))) {
+        if (vma->vm_start < start) {
+            if (split_vma(mm, vma, start)) {
+                break;
+            }
+            continue;
+        }
+        if (vma->vm_end > end && split_vma(mm, vma, end)) {
+            break;
+        }
+        if (unmap_page_range(mm, vma->vm_start, vma->vm_end)) {
+            break;
+        }
+        vt_erase(&mm->mm_vt, vma);
+        vma_free(vma);
+    }
+    flush_tlb_range(start, end);
+    return vma ? -1 : 0;
+}
+
+#define PTE_PROT_MASK (PD_ACCESS_PERM_3 | PD_ACCESS_EXEC)
+
+/*
+ * A page mapped read-only stays so, the fault handler decides on the next
+ * write whether it must be copied or dirtied first.
+ */
+static inline pteval_t change_prot_val(pteval_t val, pteval_t prot)
+{
+    return (val & ~PTE_PROT_MASK) | prot | (val & PD_ACCESS_PERM_2);
+}
+
+static bool change_prot_pmd_entry(pmd_t *pmd,
+                                  virtaddr_t addr,
+                                  struct mm_walk *walk)
+{
+    pteval_t prot = *(pteval_t *) walk->private;
+
+    if (!pmd_huge(*pmd)) {
+        return false;
+    }
+    *pmd = __pmd(change_prot_val(pmd_val(*pmd), prot));
+    return true;
+}
+
+static void change_prot_pte_range(pte_t *ptep,
+                                  virtaddr_t addr,
+                                  size_t nr,
+                                  struct mm_walk *walk)
+{
+    pteval_t prot = *(pteval_t *) walk->private;
+
+    for (size_t idx = 0; idx < nr; ++idx) {
+        if (!pte_none(ptep[idx])) {
+            ptep[idx] = __pte(change_prot_val(pte_val(ptep[idx]), prot));
+        }
+    }
+}
+
+/*
+ * Rewrite the page table entries of [start, end) for the protection of `vma`.
+ * A huge page partly in the range is split.
+ */
+static int32_t change_protection(mm_struct *mm,
+                                 struct vm_area_struct *vma,
+                                 virtaddr_t start,
+                                 virtaddr_t end)
+{
+    pteval_t prot = pgprot_val(vma->vm_page_prot) & PTE_PROT_MASK;
+    struct mm_walk walk = {
+        .mm = mm,
+        .pmd_entry = change_prot_pmd_entry,
+        .pte_range = change_prot_pte_range,
+        .private = &prot,
+    };
+    return walk_page_range(start, end, &walk);
+}
+
+/* neighbouring anonymous VMAs with the same protection can be one */
+static bool can_merge_vma(struct vm_area_struct *a, struct vm_area_struct *b)
+{
+    return b && a->vm_end == b->vm_start && !a->vm_file && !b->vm_file &&
+           !a->vm_file_start && !b->vm_file_start &&
+           pgprot_val(a->vm_page_prot) == pgprot_val(b->vm_page_prot) &&
+           a->vm_flags == b->vm_flags;
+}
+
+/* merge the VMAs from the one before `start` to the one after `end` */
+static void merge_vmas(mm_struct *mm, virtaddr_t start, virtaddr_t end)
+{
+    struct vma_tree *vt = &mm->mm_vt;
+    struct vm_area_struct *vma, *next;
+
+    if (!start || !(vma = vt_find(vt, start - 1))) {
+        vma = vt_find(vt, start);
+    }
+    while (vma && vma->vm_start <= end) {
+        next = vt_next(vt, vma);
+        if (!can_merge_vma(vma, next)) {
+            vma = next;
+            continue;
+        }
+        vt_erase(vt, next);
+        vma->vm_end = next->vm_end;
+        vt_update(vt, vma);
+        vma_free(next);
+    }
+}
+
+/*
+ * Split the VMAs crossing `start` or `end`, so that [start, end) is covered
+ * by whole VMAs. The range must be mapped.
+ */
+static int32_t split_vma_range(mm_struct *mm, virtaddr_t start, virtaddr_t end)
+{
+    struct vm_area_struct *vma;
+    int32_t ret;
 
-    KERNEL_LOG_INFO("do_mmap: address 0x%x, length %d", addr, len);
+    for (virtaddr_t va = start; va < end; va = vma->vm_end) {
+        if (!(vma = vt_find(&mm->mm_vt, va))) {
+            return -E_INVAL;
+        }
+    }
 
+    vma = vt_find(&mm->mm_vt, start);
+    if (vma->vm_start < start && (ret = split_vma(mm, vma, start))) {
+        return ret;
+    }
+    vma = vt_find(&mm->mm_vt, end - 1);
+    if (vma->vm_end > end && (ret = split_vma(mm, vma, end))) {
+        return ret;
+    }
+    return 0;
+}
+
+/* change the protection of [addr, addr + len), which must be mapped */
+int32_t do_mprotect(void *addr, size_t len, mmap_prot_t prot)
+{
+    task_t *cur = (task_t *) get_current();
+    mm_struct *mm = &cur->mm;
+    virtaddr_t start = (virtaddr_t) addr,
+               end = start + ROUNDUP(len, PAGE_SIZE), va;
+    struct vm_area_struct *vma;
+    int32_t ret = 0;
+
+    if ((start & ~PAGE_MASK) || !len || end <= start ||
+        split_vma_range(mm, start, end)) {
+        return -1;
+    }
+
+    for (va = start; va < end; va = vma->vm_end) {
+        vma = vt_find(&mm->mm_vt, va);
+        vma->vm_page_prot = vm_get_page_prot(prot);
+        // no memory to split or unshare a table, its entries keep their prot
+        if (change_protection(mm, vma, vma->vm_start, vma->vm_end)) {
+            ret = -E_NO_MEM;
+        }
+    }
+    merge_vmas(mm, start, end);
+    flush_tlb_range(start, end);
+    return ret ? -1 : 0;
+}
+
+/*
+ * Set whether huge pages may map [addr, addr + len), which must be mapped.
+ * Huge pages already mapped in the range stay.
+ */
+int32_t do_madvise(void *addr, size_t len, int32_t advice)
+{
+    task_t *cur = (task_t *) get_current();
+    mm_struct *mm = &cur->mm;
+    virtaddr_t start = (virtaddr_t) addr,
+               end = start + ROUNDUP(len, PAGE_SIZE), va;
+    struct vm_area_struct *vma;
+
+    if ((start & ~PAGE_MASK) || !len || end <= start ||
+        (advice != MADV_HUGEPAGE && advice != MADV_NOHUGEPAGE) ||
+        split_vma_range(mm, start, end)) {
+        return -1;
+    }
+
+    for (va = start; va < end; va = vma->vm_end) {
+        vma = vt_find(&mm->mm_vt, va);
+        if (advice == MADV_NOHUGEPAGE) {
+            vma->vm_flags |= VM_NOHUGEPAGE;
+        } else {
+            vma->vm_flags &= ~VM_NOHUGEPAGE;
+        }
+    }
+    merge_vmas(mm, start, end);
+    return 0;
+}
+
+/*
+ * Move the program break to `addr` and return the new break. The heap is
+ * anonymous memory from start_brk, grown by extending the VMA below the
+ * break. The break is left unchanged when `addr` is below start_brk or the
+ * heap cannot grow.
+ */
+virtaddr_t do_brk(virtaddr_t addr)
+{
+    task_t *cur = (task_t *) get_current();
+    mm_struct *mm = &cur->mm;
+    virtaddr_t old_end = ROUNDUP(mm->brk, PAGE_SIZE),
+               new_end = ROUNDUP(addr, PAGE_SIZE);
+    struct vm_area_struct *vma;
+
+    if (!mm->start_brk || addr < mm->start_brk) {
+        return mm->brk;
+    }
+
+    if (new_end < old_end) {
+        if (do_munmap((void *) new_end, old_end - new_end)) {
+            return mm->brk;
+        }
+    } else if (new_end > old_end) {
+        if (find_vma_intersection(mm, old_end, new_end)) {
+            return mm->brk;
+        }
+        vma = old_end > mm->start_brk ? vt_find(&mm->mm_vt, old_end - 1)
+                                      : NULL;
+        if (vma && !vma->vm_file && !vma->vm_file_start) {
+            vma->vm_end = new_end;
+            vt_update(&mm->mm_vt, vma);
+        } else if (!(vma = mmap_region((void *) old_end, new_end - old_end,
+                                       PROT_READ | PROT_WRITE,
+                                       MAP_FIXED | MAP_ANONYMOUS))) {
+            return mm->brk;
+        } else if (vma->vm_start != old_end) {
+            do_munmap((void *) vma->vm_start, new_end - old_end);
+            return mm->brk;
+        }
+    }
+    mm->brk = addr;
     return addr;
 }
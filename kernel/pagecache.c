@@ -0,0 +1,233 @@
+#include <include/pagecache.h>
+#include <include/radix_tree.h>
+#include <include/types.h>
+#include <include/mm.h>
+#include <include/vfs.h>
+#include <include/string.h>
+#include <include/error.h>
+#include <include/uaccess.h>
+
+void address_space_init(struct address_space *mapping,
+                        struct inode *host,
+                        const struct address_space_operations *a_ops)
+{
+    radix_tree_init(&mapping->page_tree);
+    mapping->nrpages = 0;
+    mapping->host = host;
+    mapping->a_ops = a_ops;
+    if (host) {
+        host->i_mapping = mapping;
+    }
+}
+
+/* return the cached page at `index` if it holds valid data */
+page_t *find_get_page(struct address_space *mapping, uint64_t index)
+{
+    page_t *pp = radix_tree_lookup(&mapping->page_tree, index);
+    if (pp && (pp->flags & PAGE_UPTODATE)) {
+        return pp;
+    }
+    return NULL;
+}
+
+/*
+ * Allocate a zeroed page and insert it at `index`. The page cache holds one
+ * reference of the page until it is removed. The caller fills the page and
+ * marks it PAGE_UPTODATE.
+ */
+page_t *add_to_page_cache(struct address_space *mapping, uint64_t index)
+{
+    page_t *pp = page_alloc();
+    if (!pp) {
+        return NULL;
+    }
+    pp->refcnt++;
+    if (radix_tree_insert(&mapping->page_tree, index, pp)) {
+        page_decref(pp);
+        return NULL;
+    }
+    pp->mapping = mapping;
+    pp->index = index;
+    mapping->nrpages++;
+    return pp;
+}
+
+/* return the page at `index` no matter it is up to date or not */
+page_t *grab_cache_page(struct address_space *mapping, uint64_t index)
+{
+    page_t *pp = radix_tree_lookup(&mapping->page_tree, index);
+    return pp ? pp : add_to_page_cache(mapping, index);
+}
+
+void remove_from_page_cache(page_t *pp)
+{
+    struct address_space *mapping = pp->mapping;
+    radix_tree_delete(&mapping->page_tree, pp->index);
+    mapping->nrpages--;
+    pp->mapping = NULL;
+    pp->flags &= ~PAGE_UPTODATE;
+    page_decref(pp);
+}
+
+/* drop all cached pages whose index >= start */
+void truncate_inode_pages(struct address_space *mapping, uint64_t start)
+{
+    page_t *pages[16];
+    uint32_t nr;
+
+    while ((nr = radix_tree_gang_lookup(&mapping->page_tree, (void **) pages,
+                                        start, 16))) {
+        for (uint32_t i = 0; i < nr; i++) {
+            start = pages[i]->index + 1;
+            remove_from_page_cache(pages[i]);
+        }
+    }
+}
+
+/*
+ * Drop the cached pages that can be read back from the backing store: clean
+ * ones the page cache alone holds, a page mapped by a task stays.
+ */
+void invalidate_mapping_pages(struct address_space *mapping)
+{
+    page_t *pages[16];
+    uint64_t start = 0;
+    uint32_t nr;
+
+    if (!mapping->a_ops->writepage) {
+        return;
+    }
+    while ((nr = radix_tree_gang_lookup(&mapping->page_tree, (void **) pages,
+                                        start, 16))) {
+        for (uint32_t i = 0; i < nr; i++) {
+            start = pages[i]->index + 1;
+            if (!(pages[i]->flags & PAGE_DIRTY) && pages[i]->refcnt == 1) {
+                remove_from_page_cache(pages[i]);
+            }
+        }
+    }
+}
+
+/* write back every page dirtied through a shared mapping */
+int filemap_fdatawrite(struct address_space *mapping)
+{
+    const struct address_space_operations *a_ops = mapping->a_ops;
+    page_t *pages[16];
+    uint64_t start = 0;
+    uint32_t nr;
+    int ret = 0;
+
+    while ((nr = radix_tree_gang_lookup(&mapping->page_tree, (void **) pages,
+                                        start, 16))) {
+        for (uint32_t i = 0; i < nr; i++) {
+            page_t *pp = pages[i];
+            start = pp->index + 1;
+            if (!(pp->flags & PAGE_DIRTY)) {
+                continue;
+            }
+            pp->flags &= ~PAGE_DIRTY;
+            if (a_ops->writepage && a_ops->writepage(mapping, pp)) {
+                pp->flags |= PAGE_DIRTY;
+                ret = -E_IO;
+            }
+        }
+    }
+    return ret;
+}
+
+/*
+ * Grow the readahead window while the file is read sequentially and shrink it
+ * to a single page on random access.
+ */
+static void page_cache_readahead(struct address_space *mapping,
+                                 struct file_ra_state *ra,
+                                 uint64_t index,
+                                 uint64_t last)
+{
+    if (index == ra->next_index) {
+        ra->size = ra->size ? MIN(ra->size << 1, RA_MAX_PAGES) : RA_INIT_PAGES;
+    } else {
+        ra->size = 1;
+    }
+    ra->start = index;
+    mapping->a_ops->readpages(mapping, index,
+                              (uint32_t) MIN((uint64_t) ra->size,
+                                             last - index + 1));
+}
+
+page_t *read_cache_page(struct address_space *mapping,
+                        struct file_ra_state *ra,
+                        uint64_t index)
+{
+    size_t size = mapping->host->size;
+    page_t *pp;
+
+    if (!size || index > ((size - 1) >> PAGE_SHIFT)) {
+        return NULL;
+    }
+
+    if (!(pp = find_get_page(mapping, index))) {
+        page_cache_readahead(mapping, ra, index, (size - 1) >> PAGE_SHIFT);
+        pp = find_get_page(mapping, index);
+    }
+    ra->next_index = index + 1;
+    return pp;
+}
+
+/*
+ * Read from the page cache, pages are filled by the readpages operation.
+ * Stop short at a bad user buffer, -1 if nothing was read.
+ */
+ssize_t generic_file_read(file_t *file,
+                          void *buf,
+                          size_t len,
+                          size_t *ppos)
+{
+    struct inode *inode = file->dentry->inode;
+    size_t pos = *ppos, end;
+
+    if (pos >= inode->size) {
+        return 0;
+    }
+
+    end = MIN(pos + len, inode->size);
+    while (pos < end) {
+        size_t offset = pos & ~PAGE_MASK,
+               count = MIN(PAGE_SIZE - offset, end - pos);
+        page_t *pp =
+            read_cache_page(inode->i_mapping, &file->f_ra, pos >> PAGE_SHIFT);
+        if (!pp) {
+            break;
+        }
+        if (copy_to_buf(buf, page_address(pp) + offset, count)) {
+            if (pos == *ppos) {
+                return -1;
+            }
+            break;
+        }
+        buf += count;
+        pos += count;
+    }
+
+    len = pos - *ppos;
+    *ppos = pos;
+    return len;
+}
+
+/* keep cached pages coherent with data written to the backing store */
+void pagecache_update(struct address_space *mapping,
+                      size_t pos,
+                      const void *buf,
+                      size_t len)
+{
+    while (len > 0) {
+        size_t offset = pos & ~PAGE_MASK, count = MIN(PAGE_SIZE - offset, len);
+        page_t *pp = find_get_page(mapping, pos >> PAGE_SHIFT);
+        if (pp) {
+            memcpy(page_address(pp) + offset, buf, count);
+        }
+        buf += count;
+        pos += count;
+        len -= count;
+    }
+}
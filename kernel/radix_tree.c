@@ -0,0 +1,197 @@
+#include <include/radix_tree.h>
+#include <include/types.h>
+#include <include/error.h>
+#include <include/slab.h>
+
+static uint64_t height_to_maxindex(uint32_t height)
+{
+    uint32_t bits = height * RADIX_TREE_MAP_SHIFT;
+    if (bits >= 64) {
+        return ~0ULL;
+    }
+    return (1ULL << bits) - 1;
+}
+
+static inline uint32_t slot_offset(uint64_t index, uint32_t height)
+{
+    return (index >> ((height - 1) * RADIX_TREE_MAP_SHIFT)) &
+           RADIX_TREE_MAP_MASK;
+}
+
+static struct radix_tree_node *radix_tree_node_alloc()
+{
+    return (struct radix_tree_node *) kzalloc(sizeof(struct radix_tree_node));
+}
+
+void radix_tree_init(struct radix_tree_root *root)
+{
+    root->height = 0;
+    root->rnode = NULL;
+}
+
+/* grow the tree until it is tall enough to hold `index` */
+static int radix_tree_extend(struct radix_tree_root *root, uint64_t index)
+{
+    uint32_t height = root->height ? root->height : 1;
+
+    while (index > height_to_maxindex(height)) {
+        height++;
+    }
+
+    if (!root->rnode) {
+        root->height = height;
+        return 0;
+    }
+
+    while (root->height < height) {
+        struct radix_tree_node *node = radix_tree_node_alloc();
+        if (!node) {
+            return -E_NO_MEM;
+        }
+        node->slots[0] = root->rnode;
+        node->count = 1;
+        root->rnode = node;
+        root->height++;
+    }
+    return 0;
+}
+
+/* return zero if success, otherwise return negative error number */
+int radix_tree_insert(struct radix_tree_root *root, uint64_t index, void *item)
+{
+    struct radix_tree_node *node, **slot;
+    uint32_t height;
+    int ret;
+
+    if (!item) {
+        return -E_INVAL;
+    }
+
+    if (index > height_to_maxindex(root->height) || !root->height) {
+        if ((ret = radix_tree_extend(root, index))) {
+            return ret;
+        }
+    }
+
+    slot = &root->rnode;
+    node = NULL;
+    for (height = root->height; height > 0; height--) {
+        if (!*slot) {
+            if (!(*slot = radix_tree_node_alloc())) {
+                return -E_NO_MEM;
+            }
+            if (node) {
+                node->count++;
+            }
+        }
+        node = *slot;
+        slot = (struct radix_tree_node **) &node->slots[slot_offset(
+            index, height)];
+    }
+
+    if (*slot) {
+        return -E_BUSY;
+    }
+    *slot = item;
+    node->count++;
+    return 0;
+}
+
+void *radix_tree_lookup(const struct radix_tree_root *root, uint64_t index)
+{
+    struct radix_tree_node *node = root->rnode;
+    uint32_t height = root->height;
+
+    if (!node || index > height_to_maxindex(height)) {
+        return NULL;
+    }
+
+    while (height > 0 && node) {
+        node = node->slots[slot_offset(index, height)];
+        height--;
+    }
+    return node;
+}
+
+void *radix_tree_delete(struct radix_tree_root *root, uint64_t index)
+{
+    struct radix_tree_node *path[RADIX_TREE_MAX_HEIGHT];
+    uint32_t offset[RADIX_TREE_MAX_HEIGHT];
+    struct radix_tree_node *node = root->rnode;
+    uint32_t height = root->height, level = 0;
+    void *item;
+
+    if (!node || index > height_to_maxindex(height)) {
+        return NULL;
+    }
+
+    /* record the path from root to leaf */
+    while (height > 0) {
+        if (!node) {
+            return NULL;
+        }
+        path[level] = node;
+        offset[level] = slot_offset(index, height);
+        node = node->slots[offset[level]];
+        level++;
+        height--;
+    }
+
+    if (!(item = node)) {
+        return NULL;
+    }
+
+    /* clear the slot and free nodes that become empty, bottom-up */
+    while (level-- > 0) {
+        path[level]->slots[offset[level]] = NULL;
+        if (--path[level]->count) {
+            break;
+        }
+        kfree(path[level]);
+        if (level == 0) {
+            root->rnode = NULL;
+            root->height = 0;
+        }
+    }
+    return item;
+}
+
+static uint32_t __gang_lookup(struct radix_tree_node *node,
+                              uint32_t height,
+                              uint64_t base,
+                              uint64_t first_index,
+                              void **results,
+                              uint32_t max_items)
+{
+    uint32_t found = 0, shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+    uint64_t span = height_to_maxindex(height - 1) + 1;
+
+    for (uint32_t i = 0; i < RADIX_TREE_MAP_SIZE && found < max_items; i++) {
+        uint64_t start = base + ((uint64_t) i << shift);
+        if (!node->slots[i] || (span && start + span - 1 < first_index)) {
+            continue;
+        }
+        if (height == 1) {
+            results[found++] = node->slots[i];
+        } else {
+            found += __gang_lookup(node->slots[i], height - 1, start,
+                                   first_index, results + found,
+                                   max_items - found);
+        }
+    }
+    return found;
+}
+
+/* collect up to `max_items` items whose index >= first_index in index order */
+uint32_t radix_tree_gang_lookup(const struct radix_tree_root *root,
+                                void **results,
+                                uint64_t first_index,
+                                uint32_t max_items)
+{
+    if (!root->rnode || !max_items ||
+        first_index > height_to_maxindex(root->height)) {
+        return 0;
+    }
+    return __gang_lookup(root->rnode, root->height, 0, first_index, results,
+                         max_items);
+}
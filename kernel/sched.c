@@ -66,5 +66,7 @@ void context_switch(task_t *next)
 {
     task_t *prev = (task_t *) get_current();
     update_pgd(next->mm.pgd);
+    // read by get_taskid() of the vDSO
+    asm volatile("msr tpidrro_el0, %0" ::"r"((uint64_t) next->tid));
     switch_to(prev, next);
 }
\ No newline at end of file
@@ -1,4 +1,13 @@
 #include <include/sd.h>
+#include <include/blkdev.h>
+#include <include/error.h>
+#include <include/irq.h>
+#include <include/list.h>
+#include <include/sched.h>
+#include <include/task.h>
+#include <include/types.h>
+#include <include/peripherals/dma.h>
+#include <include/peripherals/irq.h>
 
 // helper
 #define set(io_addr, val) \
@@ -16,6 +25,18 @@ static inline void delay(unsigned long tick)
 
 static int is_hcs;  // high capcacity(SDHC)
 
+/*
+ * Data is moved by DMA_CHANNEL_SD, paced by the SDHOST DREQ. The issuing task
+ * sleeps on sd_waitqueue until the DMA completion or an SDHOST error
+ * interrupt sets sd_done, even when it entered with IRQ masked as syscalls
+ * do: the tasks running meanwhile take the interrupt. Only at boot, before
+ * any task runs, the same handlers are polled instead.
+ */
+static struct dma_cb sd_cbs[BLK_MAX_SECTORS];
+static runqueue_t sd_waitqueue;
+static volatile bool sd_done;
+static volatile int sd_error;
+
 static void pin_setup()
 {
     set(GPIO_GPFSEL4, 0x24000000);
@@ -46,7 +67,8 @@ static void sdhost_setup()
     delay(250000);
     set(SDHOST_PWR, 1);
     delay(250000);
-    set(SDHOST_CFG, SDHOST_CFG_SLOW | SDHOST_CFG_INTBUS | SDHOST_CFG_DATA_EN);
+    set(SDHOST_CFG,
+        SDHOST_CFG_SLOW | SDHOST_CFG_INTBUS | SDHOST_CFG_BLOCK_IRPT_EN);
     set(SDHOST_CDIV, SDHOST_CDIV_DEFAULT);
 }
 
@@ -103,84 +125,203 @@ static int sdcard_setup()
     return 0;
 }
 
-static int wait_fifo()
+static void set_block(int size, int cnt)
+{
+    set(SDHOST_SIZE, size);
+    set(SDHOST_CNT, cnt);
+}
+
+static int wait_finish()
 {
     int cnt = 1000000;
-    unsigned int hsts;
+    unsigned int dbg;
     do {
         if (cnt == 0) {
             return -1;
         }
-        get(SDHOST_HSTS, hsts);
+        get(SDHOST_DBG, dbg);
         --cnt;
-    } while ((hsts & SDHOST_HSTS_DATA) == 0);
+    } while ((dbg & SDHOST_DBG_FSM_MASK) != SDHOST_HSTS_DATA);
     return 0;
 }
 
-static void set_block(int size, int cnt)
+static void sd_wake_up()
 {
-    set(SDHOST_SIZE, size);
-    set(SDHOST_CNT, cnt);
+    sd_done = true;
+    wake_up_all(&sd_waitqueue);
 }
 
-static void wait_finish()
+static void dma_abort()
 {
-    unsigned int dbg;
-    do {
-        get(SDHOST_DBG, dbg);
-    } while ((dbg & SDHOST_DBG_FSM_MASK) != SDHOST_HSTS_DATA);
+    set(DMA_CS(DMA_CHANNEL_SD), DMA_CS_RESET);
+    set(DMA_DEBUG(DMA_CHANNEL_SD), DMA_DEBUG_CLEAR);
 }
 
-void readblock(int block_idx, void *buf)
+/* DMA channel interrupt, the last control block is done */
+void sd_dma_irq_handler()
 {
-    unsigned int *buf_u = (unsigned int *) buf;
-    int succ = 0;
-    if (!is_hcs) {
-        block_idx <<= 9;
+    unsigned int cs;
+    get(DMA_CS(DMA_CHANNEL_SD), cs);
+    set(DMA_CS(DMA_CHANNEL_SD), DMA_CS_INT | DMA_CS_END);
+    if (cs & DMA_CS_ERROR) {
+        sd_error = -E_IO;
+        dma_abort();
     }
-    do {
-        set_block(512, 1);
-        sd_cmd(READ_SINGLE_BLOCK | SDHOST_READ, block_idx);
-        for (int i = 0; i < 128; ++i) {
-            wait_fifo();
-            get(SDHOST_DATA, buf_u[i]);
-        }
-        unsigned int hsts;
-        get(SDHOST_HSTS, hsts);
-        if (hsts & SDHOST_HSTS_ERR_MASK) {
-            set(SDHOST_HSTS, SDHOST_HSTS_ERR_MASK);
-            sd_cmd(STOP_TRANSMISSION | SDHOST_BUSY, 0);
+    sd_wake_up();
+}
+
+/* SDHOST interrupt, only errors matter since DMA reports the completion */
+void sd_irq_handler()
+{
+    unsigned int hsts;
+    get(SDHOST_HSTS, hsts);
+    set(SDHOST_HSTS, hsts & SDHOST_HSTS_MASK);
+    if (hsts & SDHOST_HSTS_ERR_MASK) {
+        sd_error = -E_IO;
+        dma_abort();
+        sd_wake_up();
+    }
+}
+
+static void sd_wait()
+{
+    task_t *cur = (task_t *) get_current();
+    uint64_t daif = irq_save();
+    unsigned int cs, hsts;
+
+    while (!sd_done) {
+        if (!cur->tid) {
+            // boot runs as the idle task, nobody else takes the interrupts
+            get(DMA_CS(DMA_CHANNEL_SD), cs);
+            get(SDHOST_HSTS, hsts);
+            if (cs & DMA_CS_INT) {
+                sd_dma_irq_handler();
+            } else if (hsts & SDHOST_HSTS_ERR_MASK) {
+                sd_irq_handler();
+            }
         } else {
-            succ = 1;
+            cur->state = TASK_BLOCKED;
+            runqueue_push(&sd_waitqueue, &cur);
+            schedule();
         }
-    } while (!succ);
-    wait_finish();
+    }
+    irq_restore(daif);
 }
 
-void writeblock(int block_idx, void *buf)
+/* one attempt of a request, the data phase is done by DMA */
+static int sd_transfer(struct request *rq)
 {
-    unsigned int *buf_u = (unsigned int *) buf;
-    int succ = 0;
-    if (!is_hcs) {
-        block_idx <<= 9;
+    bool write = (rq->op == REQ_WRITE), multi = (rq->count > 1);
+    unsigned int cmd, hsts, arg = is_hcs ? rq->sector : rq->sector << 9;
+    uint32_t fifo = BUS_PERIPHERAL_BASE | (SDHOST_DATA & 0xFFFFFF), ti;
+    struct bio *bio;
+    int i = 0;
+
+    if (write) {
+        cmd = (multi ? WRITE_MULTIPLE_BLOCK : WRITE_SINGLE_BLOCK) |
+              SDHOST_WRITE;
+        ti = DMA_TI_SRC_INC | DMA_TI_DEST_DREQ;
+    } else {
+        cmd = (multi ? READ_MULTIPLE_BLOCK : READ_SINGLE_BLOCK) | SDHOST_READ;
+        ti = DMA_TI_DEST_INC | DMA_TI_SRC_DREQ;
     }
-    do {
-        set_block(512, 1);
-        sd_cmd(WRITE_SINGLE_BLOCK | SDHOST_WRITE, block_idx);
-        for (int i = 0; i < 128; ++i) {
-            wait_fifo();
-            set(SDHOST_DATA, buf_u[i]);
+    ti |= DMA_TI_PERMAP(DMA_DREQ_SDHOST) | DMA_TI_WAIT_RESP;
+
+    // one control block per bio, chained in sector order
+    list_for_each_entry(bio, &rq->bios, bi_node)
+    {
+        uint32_t mem = PA_TO_BUS(KVA_TO_PA(bio->bi_buf));
+        sd_cbs[i].ti = ti;
+        sd_cbs[i].source_ad = write ? mem : fifo;
+        sd_cbs[i].dest_ad = write ? fifo : mem;
+        sd_cbs[i].txfr_len = bio->bi_count * 512;
+        sd_cbs[i].stride = 0;
+        sd_cbs[i].nextconbk = list_is_last(&bio->bi_node, &rq->bios)
+                                  ? 0
+                                  : PA_TO_BUS(KVA_TO_PA(&sd_cbs[i + 1]));
+        i++;
+    }
+    sd_cbs[i - 1].ti |= DMA_TI_INTEN;
+
+    sd_done = false;
+    sd_error = 0;
+    set(SDHOST_HSTS, SDHOST_HSTS_MASK);
+    set(DMA_CS(DMA_CHANNEL_SD), DMA_CS_INT | DMA_CS_END);
+    set(DMA_CONBLK_AD(DMA_CHANNEL_SD), PA_TO_BUS(KVA_TO_PA(&sd_cbs[0])));
+    set(DMA_CS(DMA_CHANNEL_SD), DMA_CS_ACTIVE | DMA_CS_PRIORITY(8) |
+                                    DMA_CS_PANIC_PRIORITY(15) |
+                                    DMA_CS_WAIT_OUTSTANDING_WRITES);
+
+    set_block(512, rq->count);
+    if (sd_cmd(cmd, arg)) {
+        dma_abort();
+        return -E_IO;
+    }
+    sd_wait();
+    if (sd_error) {
+        if (multi) {
+            sd_cmd(STOP_TRANSMISSION | SDHOST_BUSY, 0);
         }
-        unsigned int hsts;
-        get(SDHOST_HSTS, hsts);
-        if (hsts & SDHOST_HSTS_ERR_MASK) {
-            set(SDHOST_HSTS, SDHOST_HSTS_ERR_MASK);
+        return sd_error;
+    }
+
+    // the FIFO is drained by now, a write may still be leaving the FIFO
+    if (write && wait_finish()) {
+        return -E_IO;
+    }
+    if (multi) {
+        sd_cmd(STOP_TRANSMISSION | SDHOST_BUSY, 0);
+    }
+    get(SDHOST_HSTS, hsts);
+    if (hsts & SDHOST_HSTS_ERR_MASK) {
+        set(SDHOST_HSTS, SDHOST_HSTS_ERR_MASK);
+        if (!multi) {
             sd_cmd(STOP_TRANSMISSION | SDHOST_BUSY, 0);
-        } else {
-            succ = 1;
         }
-    } while (!succ);
-    wait_finish();
+        return -E_IO;
+    }
+    return wait_finish() ? -E_IO : 0;
+}
+
+/* serve one request of the block layer, bios are adjacent in sector order */
+int sd_do_request(struct request *rq)
+{
+    int ret = -E_IO;
+    for (int retry = 0; retry < SD_MAX_RETRY && ret; retry++) {
+        if ((ret = sd_transfer(rq))) {
+            set(SDHOST_HSTS, SDHOST_HSTS_MASK);
+        }
+    }
+    return ret;
+}
+
+int readblock(int block_idx, void *buf)
+{
+    return blk_rw(REQ_READ, block_idx, 1, buf);
+}
+
+int readblocks(int block_idx, int count, void *buf)
+{
+    return blk_rw(REQ_READ, block_idx, count, buf);
+}
+
+int writeblock(int block_idx, void *buf)
+{
+    return blk_rw(REQ_WRITE, block_idx, 1, buf);
+}
+
+int writeblocks(int block_idx, int count, void *buf)
+{
+    return blk_rw(REQ_WRITE, block_idx, count, buf);
+}
+
+static void dma_setup()
+{
+    runqueue_init(&sd_waitqueue);
+    *DMA_ENABLE |= 1 << DMA_CHANNEL_SD;
+    dma_abort();
+    *ENABLE_IRQS_1 |= DMA_IRQ(DMA_CHANNEL_SD);
+    *ENABLE_IRQS_2 |= SDHOST_IRQ;
 }
 
 void sd_init()
@@ -188,4 +329,5 @@ void sd_init()
     pin_setup();
     sdhost_setup();
     sdcard_setup();
+    dma_setup();
 }
\ No newline at end of file
@@ -1,62 +1,306 @@
 #include <include/signal.h>
+#include <include/arm/sysregs.h>
+#include <include/exc.h>
+#include <include/irq.h>
+#include <include/list.h>
+#include <include/slab.h>
+#include <include/string.h>
 #include <include/task.h>
+#include <include/uaccess.h>
+#include <include/vdso.h>
 
 /*
- * on success, return 0
- * on error, -1 is returned
+ * Signals are delivered on the way back to EL0, by kernel_exit calling
+ * do_signal() with the trap frame. A caught signal has its handler run on the
+ * user stack below a struct sigframe saving the interrupted registers, and
+ * the handler returns to the sigreturn trampoline of the vDSO, which restores
+ * them. One signal is delivered per return to EL0, the next one on the
+ * return from sigreturn().
+ *
+ * sig_pending, sig_blocked and sig_queue may be changed by other tasks, they
+ * are protected by masking IRQ.
  */
-int32_t do_kill(pid_t pid, int32_t sig)
+
+// SIGKILL can be neither caught, ignored nor blocked
+#define SIG_UNBLOCKABLE sigmask(SIGKILL)
+
+static inline bool valid_signal(int32_t sig)
+{
+    return sig > 0 && sig < NSIG;
+}
+
+/* the task `pid` if a signal may be sent to it */
+static task_t *signal_target(pid_t pid)
 {
     task_t *t = get_task_by_id(pid);
     if (!t || !(t->state == TASK_RUNNABLE || t->state == TASK_RUNNING)) {
         /* if a process kill itself, the process state we see is TASK_RUNNING */
-        return -1;
+        return NULL;
     }
+    return t;
+}
+
+/*
+ * Make `sig` pending on `pid`, a realtime signal is queued with `value`.
+ * On success, return 0, on error, -1 is returned.
+ */
+static int32_t send_signal(pid_t pid, int32_t sig, uint64_t value)
+{
+    task_t *t = signal_target(pid);
+    struct sigqueue *q = NULL;
+    uint64_t daif;
 
-    switch (sig) {
-    case SIGKILL:
-        t->sig_pending |= 1 << (SIGKILL - 1);
-        break;
-    default:
+    if (!t || sig < 0 || (sig && !valid_signal(sig))) {
+        return -1;
+    }
+    // signal 0 only checks that the task exists
+    if (!sig) {
+        return 0;
+    }
+    if ((sigmask(sig) & SIG_RT_MASK) && !(q = kmalloc(sizeof(*q)))) {
         return -1;
     }
+
+    daif = irq_save();
+    if (q) {
+        if (t->sig_queued >= SIGQUEUE_MAX) {
+            irq_restore(daif);
+            kfree(q);
+            return -1;
+        }
+        q->info.si_signo = sig;
+        q->info.si_pid = ((task_t *) get_current())->tid;
+        q->info.si_value = value;
+        list_add_tail(&q->list, &t->sig_queue);
+        t->sig_queued++;
+    }
+    t->sig_pending |= sigmask(sig);
+    irq_restore(daif);
     return 0;
 }
 
-static inline void bit_unset(uint32_t *val, uint8_t bit)
+int32_t do_kill(pid_t pid, int32_t sig)
+{
+    return send_signal(pid, sig, 0);
+}
+
+int32_t do_sigqueue(pid_t pid, int32_t sig, uint64_t value)
 {
-    *val &= ~(1 << bit);
+    return send_signal(pid, sig, value);
 }
 
-static inline void bit_set(uint32_t *val, uint8_t bit)
+/*
+ * Take the lowest pending signal not blocked off `task` and fill `info`.
+ * Return the signal, or 0 if there is none. IRQ must be masked.
+ */
+static int32_t dequeue_signal(task_t *task, siginfo_t *info)
 {
-    *val |= (1 << bit);
+    sigvec_t ready = task->sig_pending & ~task->sig_blocked;
+    struct sigqueue *q, *found = NULL;
+    int32_t sig;
+
+    if (!ready) {
+        return 0;
+    }
+    sig = __builtin_ffs(ready);
+    memset(info, 0, sizeof(*info));
+    info->si_signo = sig;
+    if (!(sigmask(sig) & SIG_RT_MASK)) {
+        task->sig_pending &= ~sigmask(sig);
+        return sig;
+    }
+
+    // the signal stays pending while another instance of it is queued
+    task->sig_pending &= ~sigmask(sig);
+    list_for_each_entry(q, &task->sig_queue, list)
+    {
+        if (q->info.si_signo != sig) {
+            continue;
+        }
+        if (found) {
+            task->sig_pending |= sigmask(sig);
+            break;
+        }
+        found = q;
+    }
+    if (found) {
+        *info = found->info;
+        list_del(&found->list);
+        task->sig_queued--;
+        kfree(found);
+    }
+    return sig;
 }
 
-static inline bool bit_test_and_set(uint32_t *val, uint8_t bit)
+/* push a sigframe on the user stack and have the handler of `sig` run */
+static void handle_signal(task_t *cur,
+                          struct TrapFrame *tf,
+                          struct sigaction *ka,
+                          const siginfo_t *info)
 {
-    bool t = (*val & (1 << bit));
-    bit_set(val, bit);
-    return t;
+    struct sigframe frame, *uframe;
+    int32_t sig = info->si_signo;
+    uint64_t daif;
+
+    uframe = (struct sigframe *) ROUNDDOWN(tf->sp - sizeof(frame), 16);
+    frame.info = *info;
+    memcpy(frame.regs, tf->x, sizeof(tf->x));
+    frame.regs[31] = tf->sp;
+    frame.regs[32] = tf->elr_el1;
+    frame.regs[33] = tf->spsr_el1;
+    frame.blocked = cur->sig_blocked;
+    if (copy_to_user(uframe, &frame, sizeof(frame))) {
+        // no stack left to run the handler on
+        do_exit();
+    }
+
+    tf->x[0] = sig;
+    tf->x[1] = (uint64_t) &uframe->info;
+    tf->x[2] = (uint64_t) uframe;
+    tf->x[30] = VDSO_SIGRETURN;
+    tf->sp = (uint64_t) uframe;
+    tf->elr_el1 = (uint64_t) ka->sa_handler;
+
+    daif = irq_save();
+    cur->sig_blocked |= ka->sa_mask;
+    if (!(ka->sa_flags & SA_NODEFER)) {
+        cur->sig_blocked |= sigmask(sig);
+    }
+    cur->sig_blocked &= ~SIG_UNBLOCKABLE;
+    irq_restore(daif);
+    if (ka->sa_flags & SA_RESETHAND) {
+        ka->sa_handler = SIG_DFL;
+    }
 }
 
-void do_signal()
+/* deliver a pending signal before returning to EL0 with `tf` */
+void do_signal(struct TrapFrame *tf)
 {
-    /* do signal handler in kernel mode */
     task_t *cur = (task_t *) get_current();
-    uint32_t p = cur->sig_pending;
-    while (p) {
-        uint32_t idx = __builtin_ffs(p) - 1;
-        bit_unset(&p, idx);
-        if (idx != -1 && !bit_test_and_set(&cur->sig_blocked, idx)) {
-            /* found pending and non-blocked sigal */
-            bit_unset(&cur->sig_pending, idx);
-            switch (idx + 1) {
-            case SIGKILL:
-                /* reselect process */
-                do_exit();
-            default:
+    struct sigaction *ka;
+    siginfo_t info;
+    int32_t sig;
+    uint64_t daif;
+
+    while (1) {
+        daif = irq_save();
+        sig = dequeue_signal(cur, &info);
+        irq_restore(daif);
+        if (!sig) {
+            return;
+        }
+
+        ka = &cur->sigactions[sig];
+        if (ka->sa_handler == SIG_IGN) {
+            continue;
+        }
+        if (ka->sa_handler == SIG_DFL) {
+            if (sig == SIGCHLD) {
+                continue;
             }
+            // the default action of every other signal terminates the task
+            do_exit();
+        }
+        handle_signal(cur, tf, ka, &info);
+        return;
+    }
+}
+
+/* restore the registers and the mask saved by handle_signal() */
+int64_t do_sigreturn(struct TrapFrame *tf)
+{
+    task_t *cur = (task_t *) get_current();
+    struct sigframe frame;
+    uint64_t daif;
+
+    if (copy_from_user(&frame, (void *) tf->sp, sizeof(frame))) {
+        do_exit();
+    }
+    memcpy(tf->x, frame.regs, sizeof(tf->x));
+    tf->sp = frame.regs[31];
+    tf->elr_el1 = frame.regs[32];
+    // keep returning to EL0 with IRQ unmasked, whatever the frame says
+    tf->spsr_el1 = (frame.regs[33] & SPSR_NZCV) | SPSR_EL1_VALUE;
+
+    daif = irq_save();
+    cur->sig_blocked = frame.blocked & ~SIG_UNBLOCKABLE;
+    irq_restore(daif);
+    // the syscall returns the x0 of the interrupted code
+    return tf->x[0];
+}
+
+int32_t do_sigaction(int32_t sig,
+                     const struct sigaction *act,
+                     struct sigaction *oldact)
+{
+    task_t *cur = (task_t *) get_current();
+
+    if (!valid_signal(sig) || (act && sig == SIGKILL)) {
+        return -1;
+    }
+    if (oldact) {
+        *oldact = cur->sigactions[sig];
+    }
+    if (act) {
+        cur->sigactions[sig] = *act;
+    }
+    return 0;
+}
+
+int32_t do_sigprocmask(int32_t how, const sigvec_t *set, sigvec_t *oldset)
+{
+    task_t *cur = (task_t *) get_current();
+    uint64_t daif = irq_save();
+    int32_t ret = 0;
+
+    if (oldset) {
+        *oldset = cur->sig_blocked;
+    }
+    if (set) {
+        switch (how) {
+        case SIG_BLOCK:
+            cur->sig_blocked |= *set;
+            break;
+        case SIG_UNBLOCK:
+            cur->sig_blocked &= ~*set;
+            break;
+        case SIG_SETMASK:
+            cur->sig_blocked = *set;
+            break;
+        default:
+            ret = -1;
+        }
+        cur->sig_blocked &= ~SIG_UNBLOCKABLE;
+    }
+    irq_restore(daif);
+    return ret;
+}
+
+/* on exec, caught signals go back to their default action */
+void flush_signal_handlers(task_t *task)
+{
+    for (int32_t sig = 1; sig < NSIG; sig++) {
+        struct sigaction *ka = &task->sigactions[sig];
+        if (ka->sa_handler != SIG_IGN) {
+            ka->sa_handler = SIG_DFL;
         }
+        ka->sa_mask = 0;
+        ka->sa_flags = 0;
+    }
+}
+
+/* drop the queued realtime signals of `task` */
+void flush_sigqueue(task_t *task)
+{
+    struct sigqueue *q, *tmp;
+    uint64_t daif = irq_save();
+
+    list_for_each_entry_safe(q, tmp, &task->sig_queue, list)
+    {
+        list_del(&q->list);
+        kfree(q);
     }
-}
\ No newline at end of file
+    task->sig_queued = 0;
+    task->sig_pending &= ~SIG_RT_MASK;
+    irq_restore(daif);
+}
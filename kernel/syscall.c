@@ -9,85 +9,150 @@
 #include <include/vfs.h>
 #include <include/mount.h>
 #include <include/string.h>
+#include <include/blkdev.h>
+#include <include/aio.h>
+#include <include/slab.h>
+#include <include/uaccess.h>
+#include <include/uring.h>
+#include <include/vdso.h>
 
+typedef int64_t (*syscall_fn_t)(struct TrapFrame *);
+
+/*
+ * Entries of the syscall table, taking the arguments from x0 to x3 of the
+ * trap frame and calling the sys_ wrapper of the syscall.
+ */
+#define ENTRY_ARGS_0()
+#define ENTRY_ARGS_1(t0) (t0) tf->x[0]
+#define ENTRY_ARGS_2(t0, t1) ENTRY_ARGS_1(t0), (t1) tf->x[1]
+#define ENTRY_ARGS_3(t0, t1, t2) ENTRY_ARGS_2(t0, t1), (t2) tf->x[2]
+#define ENTRY_ARGS_4(t0, t1, t2, t3) ENTRY_ARGS_3(t0, t1, t2), (t3) tf->x[3]
+
+#define SYSCALL_ENTRY(name, nr, types...)                    \
+    static int64_t __sys_##name(struct TrapFrame *tf)        \
+    {                                                        \
+        return (int64_t) sys_##name(ENTRY_ARGS_##nr(types)); \
+    }
+
+SYSCALL_ENTRY(reset, 1, uint64_t)
+SYSCALL_ENTRY(cancel_reset, 0)
+SYSCALL_ENTRY(get_timestamp, 1, struct TimeStamp *)
+SYSCALL_ENTRY(uart_read, 2, void *, size_t)
+SYSCALL_ENTRY(uart_write, 2, void *, size_t)
+SYSCALL_ENTRY(get_taskid, 0)
+SYSCALL_ENTRY(exit, 0)
+SYSCALL_ENTRY(kill, 2, pid_t, int32_t)
+SYSCALL_ENTRY(open, 2, char *, int32_t)
+SYSCALL_ENTRY(close, 1, int32_t)
+SYSCALL_ENTRY(read, 3, int32_t, void *, size_t)
+SYSCALL_ENTRY(write, 3, int32_t, void *, size_t)
+SYSCALL_ENTRY(mkdir, 1, char *)
+SYSCALL_ENTRY(chdir, 1, char *)
+SYSCALL_ENTRY(getcwd, 2, char *, size_t)
+SYSCALL_ENTRY(mount, 3, const char *, const char *, const char *)
+SYSCALL_ENTRY(opendir, 2, char *, dir_t **)
+SYSCALL_ENTRY(readdir, 4, dir_t *, char *, enum node_attr_flag *, size_t *)
+SYSCALL_ENTRY(closedir, 1, dir_t *)
+SYSCALL_ENTRY(sync, 0)
+SYSCALL_ENTRY(fsync, 1, int32_t)
+SYSCALL_ENTRY(iostat, 1, struct blk_stats *)
+SYSCALL_ENTRY(io_submit, 2, struct iocb *, int32_t)
+SYSCALL_ENTRY(io_getevents, 3, int32_t, int32_t, struct io_event *)
+SYSCALL_ENTRY(truncate, 2, char *, size_t)
+SYSCALL_ENTRY(ftruncate, 2, int32_t, size_t)
+SYSCALL_ENTRY(statfs, 2, char *, struct statfs *)
+SYSCALL_ENTRY(lseek, 3, int32_t, off_t, int32_t)
+SYSCALL_ENTRY(pread, 4, int32_t, void *, size_t, off_t)
+SYSCALL_ENTRY(pwrite, 4, int32_t, void *, size_t, off_t)
+SYSCALL_ENTRY(readv, 3, int32_t, const struct iovec *, int32_t)
+SYSCALL_ENTRY(writev, 3, int32_t, const struct iovec *, int32_t)
+SYSCALL_ENTRY(sendfile, 4, int32_t, int32_t, off_t *, size_t)
+SYSCALL_ENTRY(msync, 3, void *, size_t, int32_t)
+SYSCALL_ENTRY(munmap, 2, void *, size_t)
+SYSCALL_ENTRY(mprotect, 3, void *, size_t, int32_t)
+SYSCALL_ENTRY(brk, 1, void *)
+SYSCALL_ENTRY(spawn, 0)
+SYSCALL_ENTRY(madvise, 3, void *, size_t, int32_t)
+SYSCALL_ENTRY(execve, 3, const char *, char *const *, char *const *)
+SYSCALL_ENTRY(io_uring_setup, 1, uint32_t)
+SYSCALL_ENTRY(io_uring_enter, 1, uint32_t)
+SYSCALL_ENTRY(sigaction,
+              3,
+              int32_t,
+              const struct sigaction *,
+              struct sigaction *)
+SYSCALL_ENTRY(sigprocmask, 3, int32_t, const sigvec_t *, sigvec_t *)
+SYSCALL_ENTRY(sigqueue, 3, pid_t, int32_t, uint64_t)
+SYSCALL_ENTRY(readbench, 1, char *)
+
+/*
+ * Indexed by the syscall number in x8. The wrappers of exec, fork and mmap
+ * take the trap frame themselves.
+ */
+static const syscall_fn_t syscall_table[NR_SYSCALLS] = {
+    [SYS_reset] = __sys_reset,
+    [SYS_cancel_reset] = __sys_cancel_reset,
+    [SYS_get_timestamp] = __sys_get_timestamp,
+    [SYS_uart_read] = __sys_uart_read,
+    [SYS_uart_write] = __sys_uart_write,
+    [SYS_get_taskid] = __sys_get_taskid,
+    [SYS_exec] = sys_exec,
+    [SYS_fork] = sys_fork,
+    [SYS_exit] = __sys_exit,
+    [SYS_kill] = __sys_kill,
+    [SYS_mmap] = sys_mmap,
+    [SYS_open] = __sys_open,
+    [SYS_close] = __sys_close,
+    [SYS_read] = __sys_read,
+    [SYS_write] = __sys_write,
+    [SYS_mkdir] = __sys_mkdir,
+    [SYS_chdir] = __sys_chdir,
+    [SYS_getcwd] = __sys_getcwd,
+    [SYS_mount] = __sys_mount,
+    [SYS_opendir] = __sys_opendir,
+    [SYS_readdir] = __sys_readdir,
+    [SYS_closedir] = __sys_closedir,
+    [SYS_sync] = __sys_sync,
+    [SYS_fsync] = __sys_fsync,
+    [SYS_iostat] = __sys_iostat,
+    [SYS_io_submit] = __sys_io_submit,
+    [SYS_io_getevents] = __sys_io_getevents,
+    [SYS_truncate] = __sys_truncate,
+    [SYS_ftruncate] = __sys_ftruncate,
+    [SYS_statfs] = __sys_statfs,
+    [SYS_lseek] = __sys_lseek,
+    [SYS_pread] = __sys_pread,
+    [SYS_pwrite] = __sys_pwrite,
+    [SYS_readv] = __sys_readv,
+    [SYS_writev] = __sys_writev,
+    [SYS_sendfile] = __sys_sendfile,
+    [SYS_msync] = __sys_msync,
+    [SYS_munmap] = __sys_munmap,
+    [SYS_mprotect] = __sys_mprotect,
+    [SYS_brk] = __sys_brk,
+    [SYS_spawn] = __sys_spawn,
+    [SYS_madvise] = __sys_madvise,
+    [SYS_execve] = __sys_execve,
+    [SYS_io_uring_setup] = __sys_io_uring_setup,
+    [SYS_io_uring_enter] = __sys_io_uring_enter,
+    [SYS_sigaction] = __sys_sigaction,
+    [SYS_sigprocmask] = __sys_sigprocmask,
+    [SYS_sigqueue] = __sys_sigqueue,
+    [SYS_sigreturn] = sys_sigreturn,
+    [SYS_readbench] = __sys_readbench,
+};
+
+// the sigreturn trampoline of the vDSO has the number built in
+_Static_assert(SYS_sigreturn == VDSO_NR_SIGRETURN, "vDSO sigreturn number");
+
+/* an unknown syscall number returns -1 */
 void syscall_handler(struct TrapFrame *tf)
 {
     uint64_t syscall_num = tf->x[8];
-    int64_t ret = 0;
-
-    switch (syscall_num) {
-    case SYS_reset:
-        ret = sys_reset(tf->x[0]);
-        break;
-    case SYS_cancel_reset:
-        ret = sys_cancel_reset();
-        break;
-    case SYS_get_timestamp:
-        ret = sys_get_timestamp((struct TimeStamp *) tf->x[0]);
-        break;
-    case SYS_uart_read:
-        ret = sys_uart_read((void *) tf->x[0], (size_t) tf->x[1]);
-        break;
-    case SYS_uart_write:
-        ret = sys_uart_write((void *) tf->x[0], (size_t) tf->x[1]);
-        break;
-    case SYS_get_taskid:
-        ret = sys_get_taskid();
-        break;
-    case SYS_exec:
-        ret = sys_exec(tf);
-        break;
-    case SYS_fork:
-        ret = sys_fork(tf);
-        break;
-    case SYS_exit:
-        ret = sys_exit();
-        break;
-    case SYS_kill:
-        ret = sys_kill((pid_t) tf->x[0], (int32_t) tf->x[1]);
-        break;
-    case SYS_mmap:
-        ret = sys_mmap(tf);
-        break;
-    case SYS_open:
-        ret = sys_open((char *) tf->x[0], (int32_t) tf->x[1]);
-        break;
-    case SYS_close:
-        ret = sys_close((int32_t) tf->x[0]);
-        break;
-    case SYS_read:
-        ret =
-            sys_read((int32_t) tf->x[0], (void *) tf->x[1], (size_t) tf->x[2]);
-        break;
-    case SYS_write:
-        ret =
-            sys_write((int32_t) tf->x[0], (void *) tf->x[1], (size_t) tf->x[2]);
-        break;
-    case SYS_mkdir:
-        ret = sys_mkdir((char *) tf->x[0]);
-        break;
-    case SYS_chdir:
-        ret = sys_chdir((char *) tf->x[0]);
-        break;
-    case SYS_getcwd:
-        ret = sys_getcwd((char *) tf->x[0], (size_t) tf->x[1]);
-        break;
-    case SYS_mount:
-        ret = sys_mount((const char *) tf->x[0], (const char *) tf->x[1],
-                        (const char *) tf->x[2]);
-        break;
-    case SYS_opendir:
-        ret = sys_opendir((char *) tf->x[0], (dir_t **) tf->x[1]);
-        break;
-    case SYS_readdir:
-        ret =
-            sys_readdir((dir_t *) tf->x[0], (char *) tf->x[1],
-                        (enum node_attr_flag *) tf->x[2], (size_t *) tf->x[3]);
-        break;
-    case SYS_closedir:
-        ret = sys_closedir((dir_t *) tf->x[0]);
-        break;
-    default:
+    int64_t ret = -1;
+
+    if (syscall_num < NR_SYSCALLS && syscall_table[syscall_num]) {
+        ret = syscall_table[syscall_num](tf);
     }
     tf->x[0] = (uint64_t) ret;
 }
@@ -104,7 +169,10 @@ int64_t sys_cancel_reset()
 
 int64_t sys_get_timestamp(struct TimeStamp *ts)
 {
-    return do_get_timestamp(ts);
+    struct TimeStamp kts;
+
+    do_get_timestamp(&kts);
+    return copy_to_user(ts, &kts, sizeof(kts)) ? -1 : 0;
 }
 
 int64_t sys_uart_read(void *buf, size_t size)
@@ -150,14 +218,33 @@ int64_t sys_kill(pid_t pid, int32_t sig)
 
 int64_t sys_mmap(struct TrapFrame *tf)
 {
-    return (int64_t) do_mmap((void *) tf->x[0], (size_t) tf->x[1],
-                             (mmap_prot_t) tf->x[2], (mmap_flags_t) tf->x[3],
-                             (void *) tf->x[4], (off_t) tf->x[5]);
+    task_t *cur = (task_t *) get_current();
+    mmap_flags_t flags = (mmap_flags_t) tf->x[3];
+    int32_t fd = (int32_t) tf->x[4];
+
+    if (flags & MAP_ANONYMOUS) {
+        return (int64_t) do_mmap((void *) tf->x[0], (size_t) tf->x[1],
+                                 (mmap_prot_t) tf->x[2], flags, NULL, 0);
+    }
+    if (fd < 0 || fd >= MAX_FILE_DESCRIPTOR) {
+        return (int64_t) MAP_FAILED;
+    }
+    return (int64_t) do_mmap_file((void *) tf->x[0], (size_t) tf->x[1],
+                                  (mmap_prot_t) tf->x[2], flags,
+                                  cur->fdt[fd], (off_t) tf->x[5]);
 }
 
 int64_t sys_open(char *pathname, int32_t flags)
 {
-    return (int64_t) do_open(pathname, flags);
+    char *name = getname(pathname);
+    int64_t ret;
+
+    if (!name) {
+        return -1;
+    }
+    ret = (int64_t) do_open(name, flags);
+    kfree(name);
+    return ret;
 }
 
 int64_t sys_close(int32_t fd)
@@ -177,31 +264,78 @@ int64_t sys_read(int32_t fd, void *buf, size_t size)
 
 int64_t sys_mkdir(char *pathname)
 {
-    return (int64_t) do_mkdir(pathname);
+    char *name = getname(pathname);
+    int64_t ret;
+
+    if (!name) {
+        return -1;
+    }
+    ret = (int64_t) do_mkdir(name);
+    kfree(name);
+    return ret;
 }
 
 int64_t sys_chdir(char *pathname)
 {
-    return (int64_t) do_chdir(pathname);
+    char *name = getname(pathname);
+    int64_t ret;
+
+    if (!name) {
+        return -1;
+    }
+    ret = (int64_t) do_chdir(name);
+    kfree(name);
+    return ret;
 }
 
 int64_t sys_getcwd(char *pathname, size_t size)
 {
-    return (int64_t) do_getcwd(pathname, size);
+    char *buf = kzalloc(PATH_MAX);
+    int64_t ret;
+
+    if (!buf || !size) {
+        kfree(buf);
+        return -1;
+    }
+    ret = (int64_t) do_getcwd(buf, MIN(size, PATH_MAX));
+    if (!ret && copy_to_user(pathname, buf, MIN(strlen(buf) + 1, size))) {
+        ret = -1;
+    }
+    kfree(buf);
+    return ret;
 }
 
 int64_t sys_mount(const char *device,
                   const char *mountpoint,
                   const char *filesystem)
 {
-    return (int64_t) do_mount(device, mountpoint, filesystem);
+    char *dev = getname(device), *dir = getname(mountpoint),
+         *fs = getname(filesystem);
+    int64_t ret = -1;
+
+    if (dev && dir && fs) {
+        ret = (int64_t) do_mount(dev, dir, fs);
+    }
+    kfree(dev);
+    kfree(dir);
+    kfree(fs);
+    return ret;
 }
 
 int64_t sys_opendir(char *pathname, dir_t **dir)
 {
-    if (!dir)
+    char *name = getname(pathname);
+    dir_t *kdir;
+
+    if (!name) {
         return -1;
-    *dir = vfs_opendir(pathname);
+    }
+    kdir = vfs_opendir(name);
+    kfree(name);
+    if (copy_to_user(dir, &kdir, sizeof(kdir))) {
+        vfs_closedir(kdir);
+        return -1;
+    }
     return 0;
 }
 
@@ -215,9 +349,10 @@ int64_t sys_readdir(dir_t *dir,
     dentry_t *entry = vfs_readdir(dir);
     if (!entry)
         return -1;
-    strcpy(name, entry->name);
-    *flag = entry->flag;
-    *size = entry->inode->size;
+    if (copy_to_user(name, entry->name, strlen(entry->name) + 1) ||
+        copy_to_user(flag, &entry->flag, sizeof(*flag)) ||
+        copy_to_user(size, &entry->inode->size, sizeof(*size)))
+        return -1;
     return 0;
 }
 
@@ -225,4 +360,206 @@ int64_t sys_closedir(dir_t *dir)
 {
     vfs_closedir(dir);
     return 0;
-}
\ No newline at end of file
+}
+
+int64_t sys_sync()
+{
+    return (int64_t) do_sync();
+}
+
+int64_t sys_fsync(int32_t fd)
+{
+    return (int64_t) do_fsync(fd);
+}
+
+int64_t sys_iostat(struct blk_stats *stats)
+{
+    struct blk_stats kstats;
+
+    do_iostat(&kstats);
+    return copy_to_user(stats, &kstats, sizeof(kstats)) ? -1 : 0;
+}
+
+int64_t sys_io_submit(struct iocb *iocbs, int32_t nr)
+{
+    return (int64_t) do_io_submit(iocbs, nr);
+}
+
+int64_t sys_io_getevents(int32_t min_nr, int32_t nr, struct io_event *events)
+{
+    return (int64_t) do_io_getevents(min_nr, nr, events);
+}
+
+int64_t sys_truncate(char *pathname, size_t length)
+{
+    char *name = getname(pathname);
+    int64_t ret;
+
+    if (!name) {
+        return -1;
+    }
+    ret = (int64_t) do_truncate(name, length);
+    kfree(name);
+    return ret;
+}
+
+int64_t sys_ftruncate(int32_t fd, size_t length)
+{
+    return (int64_t) do_ftruncate(fd, length);
+}
+
+int64_t sys_statfs(char *pathname, struct statfs *buf)
+{
+    char *name = getname(pathname);
+    struct statfs kbuf;
+    int64_t ret;
+
+    if (!name) {
+        return -1;
+    }
+    ret = (int64_t) do_statfs(name, &kbuf);
+    kfree(name);
+    if (!ret && copy_to_user(buf, &kbuf, sizeof(kbuf))) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int64_t sys_lseek(int32_t fd, off_t offset, int32_t whence)
+{
+    return (int64_t) do_lseek(fd, offset, whence);
+}
+
+int64_t sys_pread(int32_t fd, void *buf, size_t size, off_t offset)
+{
+    return (int64_t) do_pread(fd, buf, size, offset);
+}
+
+int64_t sys_pwrite(int32_t fd, void *buf, size_t size, off_t offset)
+{
+    return (int64_t) do_pwrite(fd, buf, size, offset);
+}
+
+int64_t sys_readv(int32_t fd, const struct iovec *iov, int32_t iovcnt)
+{
+    return (int64_t) do_readv(fd, iov, iovcnt);
+}
+
+int64_t sys_writev(int32_t fd, const struct iovec *iov, int32_t iovcnt)
+{
+    return (int64_t) do_writev(fd, iov, iovcnt);
+}
+
+int64_t sys_sendfile(int32_t out_fd, int32_t in_fd, off_t *offset, size_t count)
+{
+    return (int64_t) do_sendfile(out_fd, in_fd, offset, count);
+}
+
+int64_t sys_msync(void *addr, size_t len, int32_t flags)
+{
+    return (int64_t) do_msync(addr, len, flags);
+}
+
+int64_t sys_munmap(void *addr, size_t len)
+{
+    return (int64_t) do_munmap(addr, len);
+}
+
+int64_t sys_mprotect(void *addr, size_t len, int32_t prot)
+{
+    return (int64_t) do_mprotect(addr, len, (mmap_prot_t) prot);
+}
+
+int64_t sys_brk(void *addr)
+{
+    return (int64_t) do_brk((virtaddr_t) addr);
+}
+
+int64_t sys_spawn()
+{
+    return do_spawn();
+}
+
+int64_t sys_madvise(void *addr, size_t len, int32_t advice)
+{
+    return (int64_t) do_madvise(addr, len, advice);
+}
+
+int64_t sys_execve(const char *path, char *const argv[], char *const envp[])
+{
+    // on the stack, do_execve() does not return on success
+    char name[PATH_MAX];
+    int64_t len = strncpy_from_user(name, path, PATH_MAX);
+
+    if (len < 0 || len == PATH_MAX) {
+        return -1;
+    }
+    return (int64_t) do_execve(name, argv, envp);
+}
+
+int64_t sys_io_uring_setup(uint32_t entries)
+{
+    return (int64_t) do_io_uring_setup(entries);
+}
+
+int64_t sys_io_uring_enter(uint32_t to_submit)
+{
+    return (int64_t) do_io_uring_enter(to_submit);
+}
+
+int64_t sys_sigaction(int32_t sig,
+                      const struct sigaction *act,
+                      struct sigaction *oldact)
+{
+    struct sigaction kact, koldact;
+    int64_t ret;
+
+    if (act && copy_from_user(&kact, act, sizeof(kact))) {
+        return -1;
+    }
+    ret = (int64_t) do_sigaction(sig, act ? &kact : NULL,
+                                 oldact ? &koldact : NULL);
+    if (!ret && oldact && copy_to_user(oldact, &koldact, sizeof(koldact))) {
+        return -1;
+    }
+    return ret;
+}
+
+int64_t sys_sigprocmask(int32_t how, const sigvec_t *set, sigvec_t *oldset)
+{
+    sigvec_t kset, koldset;
+    int64_t ret;
+
+    if (set && copy_from_user(&kset, set, sizeof(kset))) {
+        return -1;
+    }
+    ret = (int64_t) do_sigprocmask(how, set ? &kset : NULL,
+                                   oldset ? &koldset : NULL);
+    if (!ret && oldset && copy_to_user(oldset, &koldset, sizeof(koldset))) {
+        return -1;
+    }
+    return ret;
+}
+
+int64_t sys_sigqueue(pid_t pid, int32_t sig, uint64_t value)
+{
+    return (int64_t) do_sigqueue(pid, sig, value);
+}
+
+int64_t sys_sigreturn(struct TrapFrame *tf)
+{
+    return do_sigreturn(tf);
+}
+
+int64_t sys_readbench(char *pathname)
+{
+    char *name = getname(pathname);
+    int64_t ret;
+
+    if (!name) {
+        return -1;
+    }
+    ret = (int64_t) vfs_read_bench(name);
+    kfree(name);
+    return ret;
+}
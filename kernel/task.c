@@ -1,13 +1,21 @@
+#include <include/aio.h>
 #include <include/arm/sysregs.h>
 #include <include/irq.h>
 #include <include/kernel_log.h>
 #include <include/sched.h>
+#include <include/signal.h>
 #include <include/string.h>
 #include <include/task.h>
 #include <include/types.h>
 #include <include/mman.h>
+#include <include/pagecache.h>
+#include <include/slab.h>
 #include <include/elf.h>
+#include <include/error.h>
 #include <include/tlbflush.h>
+#include <include/uaccess.h>
+#include <include/uring.h>
+#include <include/vdso.h>
 #include <include/vfs.h>
 
 runqueue_t runqueue, waitqueue;
@@ -83,6 +91,225 @@ static inline int64_t get_pid()
     return -1;
 }
 
+/* mmap protection of an ELF segment with flags `p_flags` */
+static mmap_prot_t elf_prot(uint32_t p_flags)
+{
+    mmap_prot_t prot = PROT_NONE;
+    if (p_flags & PF_R) {
+        prot |= PROT_READ;
+    }
+    if (p_flags & PF_W) {
+        prot |= PROT_WRITE;
+    }
+    if (p_flags & PF_X) {
+        prot |= PROT_EXEC;
+    }
+    return prot;
+}
+
+/*
+ * Map the PT_LOAD segment `phdr` of the image at `bin_start`. Its bytes past
+ * p_filesz, the BSS, read as zero.
+ *
+ *    p_vaddr_aligned
+ *    v
+ *    |----------------- virtual space -----------------|
+ *   /                                                 /
+ *  /                                                 /
+ * |-----| loadable segment = MAX(p_memsz, p_filesz) |
+ * ^     ^
+ * |     p_offset
+ * p_offset_aligned
+ */
+static int32_t load_elf_segment(uint64_t bin_start, const Elf64_Phdr *phdr)
+{
+    uint64_t p_vaddr_aligned = ROUNDDOWN(phdr->p_vaddr, PAGE_SIZE);
+    uint64_t delta = phdr->p_vaddr - p_vaddr_aligned;
+    size_t len = delta + MAX(phdr->p_memsz, phdr->p_filesz);
+
+    if (MAP_FAILED == do_mmap_image((void *) p_vaddr_aligned, len,
+                                    elf_prot(phdr->p_flags),
+                                    (void *) bin_start,
+                                    phdr->p_offset - delta,
+                                    delta + phdr->p_filesz)) {
+        return -E_NO_MEM;
+    }
+    return 0;
+}
+
+/* map the filled page `pp` at `va` of an anonymous mapping of `mm` */
+static int32_t map_filled_page(mm_struct *mm, virtaddr_t va, page_t *pp)
+{
+    struct vm_area_struct *vma = vt_find(&mm->mm_vt, va);
+    return vma ? insert_page(mm, pp, va, vma->vm_page_prot) : -E_FAULT;
+}
+
+/*
+ * Map the PT_LOAD segment `phdr` of `file` from its page cache, a write maps
+ * a copy of the page. The page where the file bytes end and the BSS starts
+ * is read into an anonymous page with a zeroed tail, the rest of the BSS is
+ * anonymous.
+ */
+static int32_t load_elf_file_segment(file_t *file, const Elf64_Phdr *phdr)
+{
+    task_t *task = (task_t *) get_current();
+    mmap_prot_t prot = elf_prot(phdr->p_flags);
+    virtaddr_t start = ROUNDDOWN(phdr->p_vaddr, PAGE_SIZE);
+    virtaddr_t file_end = phdr->p_vaddr + phdr->p_filesz;
+    virtaddr_t mem_end = ROUNDUP(phdr->p_vaddr + phdr->p_memsz, PAGE_SIZE);
+    virtaddr_t mapped = (phdr->p_memsz > phdr->p_filesz)
+                            ? ROUNDDOWN(file_end, PAGE_SIZE)
+                            : ROUNDUP(file_end, PAGE_SIZE);
+    off_t offset = phdr->p_offset - (phdr->p_vaddr - start);
+    page_t *pp;
+
+    if (mapped > start &&
+        MAP_FAILED == do_mmap_file((void *) start, mapped - start, prot,
+                                   MAP_FIXED | MAP_PRIVATE, file, offset)) {
+        return -E_NO_MEM;
+    }
+    if (mem_end > mapped &&
+        MAP_FAILED == do_mmap((void *) mapped, mem_end - mapped, prot,
+                              MAP_FIXED | MAP_ANONYMOUS, NULL, 0)) {
+        return -E_NO_MEM;
+    }
+    if (file_end > mapped) {
+        if (!(pp = page_alloc())) {
+            return -E_NO_MEM;
+        }
+        if (vfs_pread(file, page_address(pp), file_end - mapped,
+                      offset + (mapped - start)) < 0 ||
+            map_filled_page(&task->mm, mapped, pp)) {
+            page_decref(pp);
+            return -E_IO;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Copy the strings of the user array `strv` to `*pos` of the stack page
+ * `page`, storing their offsets in `offs`. Return their number, or -1 if
+ * they fault or do not fit.
+ */
+static int32_t copy_strings(char *page,
+                            size_t *pos,
+                            char *const strv[],
+                            uint16_t *offs)
+{
+    int32_t n;
+    int64_t len;
+    char *str;
+
+    for (n = 0; strv; n++) {
+        if (copy_from_user(&str, &strv[n], sizeof(str))) {
+            return -1;
+        }
+        if (!str) {
+            break;
+        }
+        if (n == MAX_ARG_STRINGS) {
+            return -1;
+        }
+        len = strncpy_from_user(page + *pos, str, PAGE_SIZE - *pos);
+        if (len < 0 || *pos + len == PAGE_SIZE) {
+            return -1;
+        }
+        offs[n] = *pos;
+        *pos += len + 1;
+    }
+    return n;
+}
+
+/*
+ * Build the initial stack of an image entered at `entry` in `pp`, the page
+ * below USER_VIRT_TOP, and return its stack pointer. The strings of the user
+ * arrays `argv` and `envp` are moved to the top of the page:
+ *
+ *   sp -> | argc | argv[] | NULL | envp[] | NULL | auxv | pad | strings |
+ *
+ * Return 0 if the arguments fault or do not fit in the page.
+ */
+static virtaddr_t setup_arg_page(page_t *pp,
+                                 char *const argv[],
+                                 char *const envp[],
+                                 uint64_t entry)
+{
+    uint16_t argv_offs[MAX_ARG_STRINGS], envp_offs[MAX_ARG_STRINGS];
+    char *page = page_address(pp);
+    size_t bytes = 0;
+    int32_t argc = copy_strings(page, &bytes, argv, argv_offs);
+    int32_t envc = copy_strings(page, &bytes, envp, envp_offs);
+    // argc, two NULL and the AT_PAGESZ, AT_ENTRY and AT_NULL pairs
+    size_t words = argc + envc + 9;
+    virtaddr_t strings = EXEC_STACK_BASE + PAGE_SIZE - bytes;
+    uint64_t *vec;
+    size_t sp;
+
+    if (argc < 0 || envc < 0 ||
+        bytes + words * sizeof(uint64_t) + 15 > PAGE_SIZE) {
+        return 0;
+    }
+    memmove(page + PAGE_SIZE - bytes, page, bytes);
+    sp = ROUNDDOWN(PAGE_SIZE - bytes - words * sizeof(uint64_t), 16);
+    vec = (uint64_t *) (page + sp);
+    *vec++ = argc;
+    for (int32_t i = 0; i < argc; i++) {
+        *vec++ = strings + argv_offs[i];
+    }
+    *vec++ = 0;
+    for (int32_t i = 0; i < envc; i++) {
+        *vec++ = strings + envp_offs[i];
+    }
+    *vec++ = 0;
+    *vec++ = AT_PAGESZ;
+    *vec++ = PAGE_SIZE;
+    *vec++ = AT_ENTRY;
+    *vec++ = entry;
+    *vec++ = AT_NULL;
+    *vec++ = 0;
+    return EXEC_STACK_BASE + sp;
+}
+
+/*
+ * Map the vDSO and the user stack of the new image with the page `stack`
+ * from setup_arg_page() at its top, then enter the image at `entry` with
+ * argc, argv and envp as the arguments of main().
+ */
+static void start_user(page_t *stack, virtaddr_t sp, uint64_t entry)
+{
+    task_t *task = (task_t *) get_current();
+    uint64_t argc = *(uint64_t *) (page_address(stack) + sp - EXEC_STACK_BASE);
+    uint64_t argv = sp + sizeof(uint64_t);
+    uint64_t envp = argv + (argc + 1) * sizeof(uint64_t);
+
+    if (MAP_FAILED == do_mmap_image((void *) VDSO_BASE, PAGE_SIZE,
+                                    PROT_READ | PROT_EXEC, vdso_start, 0,
+                                    PAGE_SIZE) ||
+        MAP_FAILED == do_mmap((void *) (USER_VIRT_TOP - USTACK_SIZE),
+                              USTACK_SIZE, PROT_READ | PROT_WRITE,
+                              MAP_FIXED | MAP_ANONYMOUS, NULL, 0) ||
+        map_filled_page(&task->mm, EXEC_STACK_BASE, stack)) {
+        page_decref(stack);
+        do_exit();
+    }
+
+    /* update ttbr0_el1 */
+    update_pgd(task->mm.pgd);
+
+    /* switch to el0, main() gets argc, argv and envp */
+    register uint64_t x0 asm("x0") = argc;
+    register uint64_t x1 asm("x1") = argv;
+    register uint64_t x2 asm("x2") = envp;
+    asm volatile(
+        "msr     sp_el0, %3\n\t"
+        "msr     elr_el1, %4\n\t"
+        "msr     spsr_el1, %5\n\t"
+        "eret" ::"r"(x0),
+        "r"(x1), "r"(x2), "r"(sp), "r"(entry), "r"(SPSR_EL1_VALUE));
+    __builtin_unreachable();
+}
+
 /*
  * The exec() functions return only if an error has occurred. The return value
  * is -1. User must call exit() to reclaim resources after error occured.
@@ -90,86 +317,148 @@ static inline int64_t get_pid()
 int do_exec(uint64_t bin_start)
 {
     task_t *task = (task_t *) get_current();
+    Elf64_Ehdr *elf64_ehdr = (Elf64_Ehdr *) bin_start;
+    virtaddr_t brk = 0, sp;
+    page_t *stack;
 
+    if (memcmp(elf64_ehdr->e_ident, ELFMAG, SELFMAG)) {
+        return -1;
+    }
+    if (!(stack = page_alloc())) {
+        return -1;
+    }
+    sp = setup_arg_page(stack, NULL, NULL, elf64_ehdr->e_entry);
+
+    KERNEL_LOG_INFO("[PID %d] %d page faults", task->tid, task->nr_faults);
+    task->nr_faults = 0;
     mm_destroy(&task->mm);
+    exit_uring(task);
+    flush_signal_handlers(task);
 
     /* demand paging. only allocate PGD in the beggining */
     mm_init(&task->mm);
 
-    /* Reading ELF Header */
-    Elf64_Ehdr *elf64_ehdr = (Elf64_Ehdr *) bin_start;
-    // KERNEL_LOG_INFO("ELF Header Header");
-    // KERNEL_LOG_INFO(" %s %x", "e_entry", elf64_ehdr->e_entry);
-    // KERNEL_LOG_INFO(" %s %x", "e_phoff", elf64_ehdr->e_phoff);
-    // KERNEL_LOG_INFO(" %s %x", "e_phnum", elf64_ehdr->e_phnum);
-
-    /* Reading Program Header */
-    Elf64_Phdr *elf64_phdr = NULL;
+    /* map every loadable segment with its own protection */
     for (int i = 0; i < elf64_ehdr->e_phnum; ++i) {
-        elf64_phdr = (Elf64_Phdr *) (bin_start + elf64_ehdr->e_phoff +
-                                     elf64_ehdr->e_phentsize * i);
-        // KERNEL_LOG_INFO("Program Header");
-        // KERNEL_LOG_INFO(" %s %x", "p_type", elf64_phdr->p_type);
-        // KERNEL_LOG_INFO(" %s %x", "p_vaddr", elf64_phdr->p_vaddr);
-        // KERNEL_LOG_INFO(" %s %x", "p_offset", elf64_phdr->p_offset);
-        // KERNEL_LOG_INFO(" %s %x", "p_align", elf64_phdr->p_align);
-        // KERNEL_LOG_INFO(" %s %x", "p_filesz", elf64_phdr->p_filesz);
-        // KERNEL_LOG_INFO(" %s %x", "p_memsz", elf64_phdr->p_memsz);
-        // KERNEL_LOG_INFO(" %s %x", "p_flags", elf64_phdr->p_flags);
-        if (elf64_phdr->p_type == PT_LOAD) {
-            break;
+        Elf64_Phdr *elf64_phdr =
+            (Elf64_Phdr *) (bin_start + elf64_ehdr->e_phoff +
+                            elf64_ehdr->e_phentsize * i);
+        if (elf64_phdr->p_type != PT_LOAD || !elf64_phdr->p_memsz) {
+            continue;
         }
+        if (load_elf_segment(bin_start, elf64_phdr)) {
+            page_decref(stack);
+            return -1;
+        }
+        brk = MAX(brk, ROUNDUP(elf64_phdr->p_vaddr + elf64_phdr->p_memsz,
+                               PAGE_SIZE));
     }
-    if (elf64_phdr->p_type != PT_LOAD) {
+    if (!brk) {
         // KERNEL_LOG_INFO("Could not find loadable segment!");
+        page_decref(stack);
         return -1;
     }
 
-    /*    p_vaddr_aligned
-     *    v
-     *    |----------------- virtual space -----------------|
-     *   /                                                 /
-     *  /                                                 /
-     * |-----| loadable segment = MAX(p_memsz, p_filesz) |
-     * ^     ^
-     * |     p_offset
-     * p_offset_aligned
-     */
-    uint64_t p_vaddr = elf64_phdr->p_vaddr;
-    uint64_t p_filesz = elf64_phdr->p_filesz;
-    uint32_t p_flags = elf64_phdr->p_flags;
-    uint64_t p_offset = elf64_phdr->p_offset;
-    uint64_t p_memsz = elf64_phdr->p_memsz;
-    uint64_t p_vaddr_aligned = ROUNDDOWN(p_vaddr, PAGE_SIZE);
-    uint64_t p_offset_aligned = ROUNDDOWN(p_offset, PAGE_SIZE);
-
-    /* allocate memory for .txt & .bss section */
-    if (MAP_FAILED ==
-        do_mmap((void *) p_vaddr_aligned,
-                MAX(p_memsz, p_filesz) + (p_offset - p_offset_aligned), p_flags,
-                MAP_FIXED, (void *) bin_start, p_offset_aligned))
-        return -1;
+    /* the heap starts at the page after the highest segment */
+    task->mm.start_brk = task->mm.brk = brk;
+
+    start_user(stack, sp, elf64_ehdr->e_entry);
+    __builtin_unreachable();
+}
+
+/* check the loadable segments of an executable, return the end of the last */
+static virtaddr_t check_elf_phdrs(const Elf64_Phdr *phdrs, int32_t phnum)
+{
+    virtaddr_t end = 0;
 
-    /* allocate stack */
-    uintptr_t sp = USER_VIRT_TOP - sizeof(uintptr_t);
-    if (MAP_FAILED == do_mmap((void *) sp, PAGE_SIZE, PROT_READ | PROT_WRITE,
-                              MAP_ANONYMOUS, NULL, 0)) {
-        //@todo unmap .txt & .bss section
+    for (int32_t i = 0; i < phnum; i++) {
+        if (phdrs[i].p_type != PT_LOAD || !phdrs[i].p_memsz) {
+            continue;
+        }
+        // a segment is mapped from its file offset page by page
+        if (((phdrs[i].p_vaddr - phdrs[i].p_offset) & ~PAGE_MASK) ||
+            phdrs[i].p_filesz > phdrs[i].p_memsz ||
+            phdrs[i].p_vaddr + phdrs[i].p_memsz > EXEC_STACK_BASE) {
+            return 0;
+        }
+        end = MAX(end, ROUNDUP(phdrs[i].p_vaddr + phdrs[i].p_memsz, PAGE_SIZE));
+    }
+    return end;
+}
+
+/*
+ * Execute the ELF executable at `path` of the file system, with the user
+ * arrays of argument strings `argv` and environment `envp`. Its segments are
+ * mapped from the page cache of the file, so pages are read in when first
+ * touched.
+ *
+ * execve() returns -1 only while the old image is intact. The arguments are
+ * copied out of it first, a failure after it is destroyed kills the task.
+ */
+int do_execve(const char *path, char *const argv[], char *const envp[])
+{
+    task_t *task = (task_t *) get_current();
+    Elf64_Ehdr ehdr;
+    Elf64_Phdr *phdrs = NULL;
+    page_t *stack = NULL;
+    virtaddr_t brk, sp;
+    file_t *file;
+    size_t phsize;
+
+    if (!path || !(file = vfs_open(path, 0))) {
         return -1;
     }
+    if (file->dentry->flag != FILE ||
+        vfs_pread(file, &ehdr, sizeof(ehdr), 0) != (int) sizeof(ehdr) ||
+        memcmp(ehdr.e_ident, ELFMAG, SELFMAG) ||
+        ehdr.e_phentsize != sizeof(Elf64_Phdr) || !ehdr.e_phnum ||
+        ehdr.e_phnum > ELF_MAX_PHNUM) {
+        goto fail;
+    }
+    phsize = ehdr.e_phnum * sizeof(Elf64_Phdr);
+    if (!(phdrs = kmalloc(phsize)) ||
+        vfs_pread(file, phdrs, phsize, ehdr.e_phoff) != (int) phsize ||
+        !(brk = check_elf_phdrs(phdrs, ehdr.e_phnum))) {
+        goto fail;
+    }
+    if (!(stack = page_alloc()) ||
+        !(sp = setup_arg_page(stack, argv, envp, ehdr.e_entry))) {
+        goto fail;
+    }
 
-    /* update ttbr0_el1 */
-    update_pgd(task->mm.pgd);
+    KERNEL_LOG_INFO("[PID %d] %d page faults", task->tid, task->nr_faults);
+    task->nr_faults = 0;
+    mm_destroy(&task->mm);
+    exit_uring(task);
+    flush_signal_handlers(task);
+    mm_init(&task->mm);
 
-    /* switch to el0 */
-    asm volatile(
-        "msr     sp_el0, %0\n\t"
-        "msr     elr_el1, %1\n\t"
-        "msr     spsr_el1, %2\n\t"
-        "eret" ::"r"(sp),
-        "r"(p_vaddr_aligned + (p_offset - p_offset_aligned)),
-        "r"(SPSR_EL1_VALUE));
+    for (int32_t i = 0; i < ehdr.e_phnum; i++) {
+        if (phdrs[i].p_type == PT_LOAD && phdrs[i].p_memsz &&
+            load_elf_file_segment(file, &phdrs[i])) {
+            page_decref(stack);
+            kfree(phdrs);
+            vfs_close(file);
+            do_exit();
+        }
+    }
+    // the mappings hold their own reference of the file
+    kfree(phdrs);
+    vfs_close(file);
+
+    /* the heap starts at the page after the highest segment */
+    task->mm.start_brk = task->mm.brk = brk;
+
+    start_user(stack, sp, ehdr.e_entry);
     __builtin_unreachable();
+
+fail:
+    if (stack) {
+        page_decref(stack);
+    }
+    kfree(phdrs);
+    vfs_close(file);
+    return -1;
 }
 
 /*
@@ -206,14 +495,51 @@ int64_t do_fork(struct TrapFrame *tf)
     new_task->task_context.sp = (uint64_t) tf_new;
     new_task->state = TASK_RUNNABLE;
     new_task->sig_blocked = cur_task->sig_blocked;
-    new_task->sig_pending = cur_task->sig_pending;
+    // the queue of realtime signals is not inherited
+    new_task->sig_pending = cur_task->sig_pending & ~SIG_RT_MASK;
+    memcpy(new_task->sigactions, cur_task->sigactions,
+           sizeof(cur_task->sigactions));
 
     return new_task_id;
 }
 
+static void spawn_entry()
+{
+    extern char _binary_user_user_elf_start;
+    task_t *cur = (task_t *) get_current();
+
+    // skip the image of a child killed before it got to run
+    if (!(cur->sig_pending & (1 << (SIGKILL - 1)))) {
+        do_exec((uint64_t) &_binary_user_user_elf_start);
+    }
+    do_exit();
+}
+
+/*
+ * Create a task running the embedded user program. Unlike fork() followed by
+ * exec(), the address space of the caller is not copied, the child starts
+ * with an empty one. Other programs are run by fork() and execve(), which
+ * load them from a file. On success, the task id of the child is returned,
+ * -1 otherwise.
+ */
+int64_t do_spawn()
+{
+    int64_t new_task_id = privilege_task_create(spawn_entry);
+    if (new_task_id < 0)
+        return -1;
+    task_t *new_task = get_task_by_id(new_task_id);
+
+    new_task->sig_blocked = get_current()->sig_blocked;
+    return new_task_id;
+}
+
 void do_exit()
 {
     task_t *cur = (task_t *) get_current();
+    KERNEL_LOG_INFO("[PID %d] %d page faults", cur->tid, cur->nr_faults);
+    exit_aio(cur);
+    exit_uring(cur);
+    flush_sigqueue(cur);
     cur->state = TASK_ZOMBIE;
     list_add_tail(&cur->node, &zombie_list);
     mm_destroy(&cur->mm);
@@ -235,8 +561,16 @@ int64_t privilege_task_create(void (*func)())
     task->counter = TASK_EPOCH;
     task->sig_pending = 0;
     task->sig_blocked = 0;
+    memset(task->sigactions, 0, sizeof(task->sigactions));
+    INIT_LIST_HEAD(&task->sig_queue);
+    task->sig_queued = 0;
     mm_init(&task->mm);
     INIT_LIST_HEAD(&task->node);
+    INIT_LIST_HEAD(&task->aio_done);
+    task->aio_nr = 0;
+    task->aio_active = 0;
+    task->uring = NULL;
+    task->nr_faults = 0;
 
     dentry_t *dentry;
     char last_component_name[256];
@@ -292,6 +626,17 @@ void runqueue_pop(runqueue_t *rq, task_t **t)
     rq->head &= rq->mask;
 }
 
+/* move every task of `rq` to the runqueue, IRQ must be masked */
+void wake_up_all(runqueue_t *rq)
+{
+    while (!runqueue_is_empty(rq)) {
+        task_t *t;
+        runqueue_pop(rq, &t);
+        t->state = TASK_RUNNABLE;
+        runqueue_push(&runqueue, &t);
+    }
+}
+
 __attribute__((optimize("O0"))) static void delay(uint64_t count)
 {
     for (uint64_t i = 0; i < count; ++i)
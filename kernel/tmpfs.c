@@ -5,8 +5,34 @@
 #include <include/slab.h>
 #include <include/string.h>
 #include <include/mount.h>
+#include <include/pagecache.h>
+#include <include/mm.h>
+#include <include/uaccess.h>
 
 static int setup_vnode(struct vnode *node);
+static int tmpfs_readpages(struct address_space *mapping,
+                           uint64_t index,
+                           uint32_t nr_pages);
+
+static const struct address_space_operations tmpfs_aops = {
+    .readpages = tmpfs_readpages,
+    .writepage = NULL,  // the page cache is the backing store
+};
+
+static inline struct tmpfs_sb_info *TMPFS_SB(struct super_block *sb)
+{
+    return (struct tmpfs_sb_info *) sb->s_fs_info;
+}
+
+static tmpfs_node_t *tmpfs_node_alloc(struct super_block *sb)
+{
+    tmpfs_node_t *n = (tmpfs_node_t *) kzalloc(sizeof(tmpfs_node_t));
+    if (n) {
+        address_space_init(&n->mapping, &n->inode, &tmpfs_aops);
+        n->sb = sb;
+    }
+    return n;
+}
 
 static int v_lookup(dentry_t *dir,
                     dentry_t **target,
@@ -73,14 +99,14 @@ static int v_create(dentry_t *dir_node,
         goto _v_create_fail;
     }
     new->parent = dir_node;
-    new->d_sb = NULL;
+    new->d_sb = dir_node->d_sb;
     new->d_mount = NULL;
     new->p_mount = NULL;
     INIT_LIST_HEAD(&new->l_head);
     INIT_LIST_HEAD(&new->c_head);
 
     // set up inode
-    tmpfs_node_t *n = (tmpfs_node_t *) kzalloc(sizeof(tmpfs_node_t));
+    tmpfs_node_t *n = tmpfs_node_alloc(dir_node->d_sb);
     if (!n) {
         goto _v_create_fail;
     }
@@ -102,37 +128,150 @@ _v_create_fail:
     return -1;
 }
 
-static int f_write(file_t *file, const void *buf, size_t len)
+/* return the page at `index`, allocated within the mount's limit */
+static page_t *tmpfs_get_page(tmpfs_node_t *n, uint64_t index)
+{
+    struct tmpfs_sb_info *sbi = TMPFS_SB(n->sb);
+    page_t *pp = find_get_page(&n->mapping, index);
+
+    if (pp) {
+        return pp;
+    }
+    if (sbi->used_pages >= sbi->max_pages ||
+        !(pp = add_to_page_cache(&n->mapping, index))) {
+        return NULL;
+    }
+    pp->flags |= PAGE_UPTODATE;
+    sbi->used_pages++;
+    return pp;
+}
+
+static int f_write(file_t *file, const void *buf, size_t len, size_t *ppos)
 {
     tmpfs_node_t *n =
         container_of(file->dentry->inode, struct tmpfs_node, inode);
     struct inode *i = &n->inode;
-    uint8_t *data = n->buffer;
-    int count = MIN(len, TMPFS_FIEL_BUFFER_MAX_LEN - file->f_pos);
-    memcpy(data + file->f_pos, buf, count);
-    file->f_pos += count;
-    if (file->f_pos > i->size) {
-        i->size = file->f_pos;  // update file length
-    }
-    return count;
+    size_t pos = *ppos, end = pos + len;
+
+    while (pos < end) {
+        size_t offset = pos & ~PAGE_MASK,
+               count = MIN(PAGE_SIZE - offset, end - pos);
+        page_t *pp = tmpfs_get_page(n, pos >> PAGE_SHIFT);
+        if (!pp) {
+            break;  // the mount is full
+        }
+        if (copy_from_buf(page_address(pp) + offset, buf, count)) {
+            if (pos == *ppos) {
+                return -1;  // bad user buffer
+            }
+            break;
+        }
+        buf += count;
+        pos += count;
+    }
+
+    len = pos - *ppos;
+    *ppos = pos;
+    if (pos > i->size) {
+        i->size = pos;  // update file length
+    }
+    return len;
 }
 
-static int f_read(file_t *file, void *buf, size_t len)
+static int f_read(file_t *file, void *buf, size_t len, size_t *ppos)
 {
+    static const uint8_t zero_page[PAGE_SIZE];
     tmpfs_node_t *n =
         container_of(file->dentry->inode, struct tmpfs_node, inode);
     struct inode *i = &n->inode;
-    uint8_t *data = n->buffer;
-    int count = MIN(len, i->size - file->f_pos);
-    memcpy(buf, data + file->f_pos, count);
-    file->f_pos += count;
-    return count;
+    size_t pos = *ppos, end;
+
+    if (pos >= i->size) {
+        return 0;
+    }
+
+    end = MIN(pos + len, i->size);
+    while (pos < end) {
+        size_t offset = pos & ~PAGE_MASK,
+               count = MIN(PAGE_SIZE - offset, end - pos);
+        page_t *pp = find_get_page(&n->mapping, pos >> PAGE_SHIFT);
+        // a hole reads as zeros
+        const void *src = pp ? page_address(pp) + offset : zero_page;
+        if (copy_to_buf(buf, src, count)) {
+            if (pos == *ppos) {
+                return -1;  // bad user buffer
+            }
+            break;
+        }
+        buf += count;
+        pos += count;
+    }
+
+    len = pos - *ppos;
+    *ppos = pos;
+    return len;
+}
+
+/* a hole is read through a mapping, back it with a zeroed page */
+static int tmpfs_readpages(struct address_space *mapping,
+                           uint64_t index,
+                           uint32_t nr_pages)
+{
+    tmpfs_node_t *n = container_of(mapping->host, tmpfs_node_t, inode);
+    return tmpfs_get_page(n, index) ? 0 : -E_NO_MEM;
+}
+
+/* shrinking frees the pages past the end, growing leaves a hole */
+static int v_truncate(dentry_t *dentry, size_t length)
+{
+    tmpfs_node_t *n = container_of(dentry->inode, struct tmpfs_node, inode);
+    struct tmpfs_sb_info *sbi = TMPFS_SB(n->sb);
+    size_t nrpages = n->mapping.nrpages, offset = length & ~PAGE_MASK;
+    page_t *pp;
+
+    if (dentry->flag != FILE) {
+        return -1;
+    }
+    if (length < n->inode.size) {
+        truncate_inode_pages(&n->mapping,
+                             ROUNDUP(length, PAGE_SIZE) >> PAGE_SHIFT);
+        sbi->used_pages -= nrpages - n->mapping.nrpages;
+        // a later extension must read zeros from the partial page
+        if (offset && (pp = find_get_page(&n->mapping, length >> PAGE_SHIFT))) {
+            memset(page_address(pp) + offset, 0, PAGE_SIZE - offset);
+        }
+    }
+    n->inode.size = length;
+    return 0;
 }
 
+static int tmpfs_statfs(struct super_block *sb, struct statfs *buf)
+{
+    struct tmpfs_sb_info *sbi = TMPFS_SB(sb);
+
+    buf->f_bsize = PAGE_SIZE;
+    buf->f_blocks = sbi->max_pages;
+    buf->f_bfree = sbi->max_pages - sbi->used_pages;
+    return 0;
+}
+
+static const struct super_operations tmpfs_super_ops = {
+    .statfs = tmpfs_statfs,
+};
+
 static int tmpfs_fill_super(struct super_block *sb, void *data)
 {
+    struct tmpfs_sb_info *sbi;
+
     if (!sb)
-        goto _error;
+        return -1;
+
+    // set up accounting of the mount
+    sbi = (struct tmpfs_sb_info *) kzalloc(sizeof(struct tmpfs_sb_info));
+    if (!sbi)
+        return -1;
+    sbi->max_pages = TMPFS_MAX_PAGES;
+    sbi->used_pages = 0;
 
     // set up dentry of root directory
     dentry_t *root = (dentry_t *) kzalloc(sizeof(dentry_t));
@@ -151,7 +290,7 @@ static int tmpfs_fill_super(struct super_block *sb, void *data)
     INIT_LIST_HEAD(&root->c_head);
 
     // set up inode
-    tmpfs_node_t *n = (tmpfs_node_t *) kzalloc(sizeof(tmpfs_node_t));
+    tmpfs_node_t *n = tmpfs_node_alloc(sb);
     if (!n) {
         goto _error;
     }
@@ -160,6 +299,8 @@ static int tmpfs_fill_super(struct super_block *sb, void *data)
 
     // set up superblock
     sb->s_root = root;
+    sb->s_op = &tmpfs_super_ops;
+    sb->s_fs_info = sbi;
     INIT_LIST_HEAD(&sb->s_mounts);
     return 0;
 
@@ -168,6 +309,7 @@ _error:
         kfree(root->vnode);
     }
     kfree(root);
+    kfree(sbi);
     return -1;
 }
 
@@ -183,6 +325,7 @@ static int setup_vnode(struct vnode *node)
 
     node->v_ops->lookup = v_lookup;
     node->v_ops->create = v_create;
+    node->v_ops->truncate = v_truncate;
     node->f_ops->write = f_write;
     node->f_ops->read = f_read;
 
@@ -0,0 +1,97 @@
+#include <include/error.h>
+#include <include/slab.h>
+#include <include/string.h>
+#include <include/types.h>
+#include <include/uaccess.h>
+#include <include/vfs.h>
+
+extern struct exception_table_entry __start___ex_table[], __stop___ex_table[];
+
+size_t __copy_user(void *to, const void *from, size_t n);
+int64_t __strncpy_from_user(char *dst, const char *src, size_t count);
+
+/* return where the instruction at `addr` resumes on a bad fault, or 0 */
+uint64_t search_exception_table(uint64_t addr)
+{
+    struct exception_table_entry *e;
+
+    for (e = __start___ex_table; e < __stop___ex_table; e++) {
+        if (e->insn == addr) {
+            return e->fixup;
+        }
+    }
+    return 0;
+}
+
+/* return the number of bytes not copied, zero on success */
+size_t copy_from_user(void *to, const void *from, size_t n)
+{
+    if (!access_ok(from, n)) {
+        return n;
+    }
+    return __copy_user(to, from, n);
+}
+
+/* return the number of bytes not copied, zero on success */
+size_t copy_to_user(void *to, const void *from, size_t n)
+{
+    if (!access_ok(to, n)) {
+        return n;
+    }
+    return __copy_user(to, from, n);
+}
+
+/*
+ * Copies for the buffer of a file operation, which is user memory checked by
+ * the syscall, or kernel memory when a kernel task or the ELF loader does the
+ * I/O. Return the number of bytes not copied, like the user copies.
+ */
+size_t copy_from_buf(void *to, const void *from, size_t n)
+{
+    if ((virtaddr_t) from >= USER_VIRT_LIMIT) {
+        memcpy(to, from, n);
+        return 0;
+    }
+    return copy_from_user(to, from, n);
+}
+
+size_t copy_to_buf(void *to, const void *from, size_t n)
+{
+    if ((virtaddr_t) to >= USER_VIRT_LIMIT) {
+        memcpy(to, from, n);
+        return 0;
+    }
+    return copy_to_user(to, from, n);
+}
+
+/*
+ * Copy the string at `src` into `dst` of `count` bytes. Return its length,
+ * `count` if it is not terminated within `count` bytes, or -E_FAULT.
+ */
+int64_t strncpy_from_user(char *dst, const char *src, size_t count)
+{
+    int64_t ret;
+
+    if (!access_ok(src, 1)) {
+        return -E_FAULT;
+    }
+    ret = __strncpy_from_user(dst, src, count);
+    return ret < 0 ? -E_FAULT : ret;
+}
+
+/* copy the user path `pathname` into a new buffer, NULL if it is invalid */
+char *getname(const char *pathname)
+{
+    char *name = kmalloc(PATH_MAX);
+    int64_t len;
+
+    if (!name) {
+        return NULL;
+    }
+    len = strncpy_from_user(name, pathname, PATH_MAX);
+    if (len < 0 || len == PATH_MAX) {
+        kfree(name);
+        return NULL;
+    }
+    return name;
+}
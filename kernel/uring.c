@@ -0,0 +1,136 @@
+#include <include/uring.h>
+#include <include/mm.h>
+#include <include/mman.h>
+#include <include/pagecache.h>
+#include <include/slab.h>
+#include <include/task.h>
+#include <include/types.h>
+#include <include/uaccess.h>
+#include <include/vfs.h>
+
+/*
+ * Batched file operations. io_uring_setup() maps a page holding a submission
+ * and a completion ring into the task, which queues sqes there without
+ * trapping. io_uring_enter() then runs the queued operations in one trap and
+ * posts a cqe for each of them, so N operations cost one kernel_entry instead
+ * of N. An open file is used by later sqes of the same batch with
+ * IOSQE_FD_LAST, its fd being unknown to the task when it queues them.
+ *
+ * The kernel reaches the rings through its own mapping of the page, the task
+ * may unmap its view without the kernel noticing.
+ */
+
+static inline struct io_uring *task_uring(task_t *task)
+{
+    return task->uring ? page_address(task->uring) : NULL;
+}
+
+struct io_uring *do_io_uring_setup(uint32_t entries)
+{
+    task_t *cur = (task_t *) get_current();
+    struct io_uring *ring;
+    page_t *pp;
+    void *addr;
+
+    if (cur->uring || !entries || entries > URING_MAX_ENTRIES ||
+        (entries & (entries - 1))) {
+        return NULL;
+    }
+    if (!(pp = page_alloc())) {
+        return NULL;
+    }
+    addr = do_mmap_kernel_page(pp, PROT_READ | PROT_WRITE);
+    if (addr == MAP_FAILED) {
+        page_decref(pp);
+        return NULL;
+    }
+    ring = page_address(pp);
+    ring->entries = entries;
+    cur->uring = pp;
+    return (struct io_uring *) addr;
+}
+
+/*
+ * Run the operation of `sqe` as its syscall would. The buffer of READ and
+ * WRITE is checked to be user memory by do_read() and the others, like the
+ * arguments of the syscalls.
+ */
+static int64_t uring_issue(const struct io_uring_sqe *sqe)
+{
+    char *name;
+    int64_t ret;
+
+    switch (sqe->opcode) {
+    case IORING_OP_NOP:
+        return 0;
+    case IORING_OP_OPEN:
+        if (!(name = getname((const char *) sqe->addr))) {
+            return -1;
+        }
+        ret = do_open(name, (int32_t) sqe->len);
+        kfree(name);
+        return ret;
+    case IORING_OP_CLOSE:
+        return do_close(sqe->fd);
+    case IORING_OP_READ:
+        if (sqe->off == -1) {
+            return do_read(sqe->fd, (void *) sqe->addr, sqe->len);
+        }
+        return do_pread(sqe->fd, (void *) sqe->addr, sqe->len, sqe->off);
+    case IORING_OP_WRITE:
+        if (sqe->off == -1) {
+            return do_write(sqe->fd, (void *) sqe->addr, sqe->len);
+        }
+        return do_pwrite(sqe->fd, (void *) sqe->addr, sqe->len, sqe->off);
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Run up to `to_submit` queued sqes in order and return how many were
+ * consumed. Submission stops early when the completion ring is full, the
+ * remaining sqes stay queued.
+ */
+int32_t do_io_uring_enter(uint32_t to_submit)
+{
+    struct io_uring *ring = task_uring((task_t *) get_current());
+    struct io_uring_sqe sqe;
+    struct io_uring_cqe *cqe;
+    uint32_t mask, head, nr = 0;
+    int32_t last_fd = -1;
+
+    if (!ring) {
+        return -1;
+    }
+    // the task may have rewritten entries, stay inside the page anyway
+    mask = (ring->entries - 1) & (URING_MAX_ENTRIES - 1);
+    head = ring->sq_head;
+    while (nr < to_submit && head != ring->sq_tail &&
+           ring->cq_tail - ring->cq_head < ring->entries) {
+        // a copy, the task may rewrite the slot once sq_head moved past it
+        sqe = ring->sqes[head & mask];
+        if (sqe.flags & IOSQE_FD_LAST) {
+            sqe.fd = last_fd;
+        }
+        cqe = &ring->cqes[ring->cq_tail & mask];
+        cqe->user_data = sqe.user_data;
+        cqe->res = uring_issue(&sqe);
+        if (sqe.opcode == IORING_OP_OPEN) {
+            last_fd = cqe->res;
+        }
+        ring->cq_tail++;
+        ring->sq_head = ++head;
+        nr++;
+    }
+    return nr;
+}
+
+/* drop the rings of `task`, its mapping of them goes with its mm */
+void exit_uring(task_t *task)
+{
+    if (task->uring) {
+        page_decref(task->uring);
+        task->uring = NULL;
+    }
+}
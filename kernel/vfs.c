@@ -10,6 +10,11 @@
 #include <include/slab.h>
 #include <include/mount.h>
 #include <include/list.h>
+#include <include/pagecache.h>
+#include <include/printk.h>
+#include <include/utils.h>
+#include <include/buffer.h>
+#include <include/uaccess.h>
 
 struct dentry *root_dir = NULL;
 static LIST_HEAD(filesystem_list);
@@ -158,12 +163,98 @@ int vfs_close(file_t *file)
 
 int vfs_write(file_t *file, const void *buf, size_t len)
 {
-    return file->dentry->vnode->f_ops->write(file, buf, len);
+    return file->dentry->vnode->f_ops->write(file, buf, len, &file->f_pos);
 }
 
 int vfs_read(file_t *file, void *buf, size_t len)
 {
-    return file->dentry->vnode->f_ops->read(file, buf, len);
+    return file->dentry->vnode->f_ops->read(file, buf, len, &file->f_pos);
+}
+
+/* positional I/O, file->f_pos is not used nor moved */
+int vfs_pwrite(file_t *file, const void *buf, size_t len, size_t pos)
+{
+    return file->dentry->vnode->f_ops->write(file, buf, len, &pos);
+}
+
+int vfs_pread(file_t *file, void *buf, size_t len, size_t pos)
+{
+    return file->dentry->vnode->f_ops->read(file, buf, len, &pos);
+}
+
+off_t vfs_lseek(file_t *file, off_t offset, int whence)
+{
+    off_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = (off_t) file->f_pos;
+        break;
+    case SEEK_END:
+        base = (off_t) file->dentry->inode->size;
+        break;
+    default:
+        return -1;
+    }
+    if (base + offset < 0) {
+        return -1;
+    }
+    file->f_pos = (size_t) (base + offset);
+    return (off_t) file->f_pos;
+}
+
+/*
+ * Copy `count` bytes of `in` from *ppos to `out` at its position. The data is
+ * written straight from the page cache of `in`, holes of a file without
+ * readpages operation are written from a zero page.
+ */
+ssize_t vfs_sendfile(file_t *out, file_t *in, size_t *ppos, size_t count)
+{
+    static const uint8_t zero_page[PAGE_SIZE];
+    struct inode *inode = in->dentry->inode;
+    struct address_space *mapping = inode->i_mapping;
+    size_t pos = *ppos, end;
+    int ret;
+
+    if (!mapping || in->dentry->flag != FILE) {
+        return -1;
+    }
+    if (pos >= inode->size) {
+        return 0;
+    }
+
+    end = MIN(pos + count, inode->size);
+    while (pos < end) {
+        size_t offset = pos & ~PAGE_MASK,
+               len = MIN(PAGE_SIZE - offset, end - pos);
+        const void *src = zero_page;
+        page_t *pp;
+
+        if (mapping->a_ops->readpages) {
+            if (!(pp = read_cache_page(mapping, &in->f_ra,
+                                       pos >> PAGE_SHIFT))) {
+                break;  // I/O error
+            }
+            src = page_address(pp) + offset;
+        } else if ((pp = find_get_page(mapping, pos >> PAGE_SHIFT))) {
+            src = page_address(pp) + offset;
+        }
+
+        ret = out->dentry->vnode->f_ops->write(out, src, len, &out->f_pos);
+        if (ret > 0) {
+            pos += ret;
+        }
+        if (ret < (int) len) {
+            break;
+        }
+    }
+
+    count = pos - *ppos;
+    *ppos = pos;
+    return count;
 }
 
 dir_t *vfs_opendir(char *pathname)
@@ -262,6 +353,14 @@ int vfs_getcwd(char *pathname, size_t size)
     return 0;
 }
 
+int vfs_truncate(dentry_t *dentry, size_t length)
+{
+    if (dentry->flag != FILE || !dentry->vnode->v_ops->truncate) {
+        return -1;
+    }
+    return dentry->vnode->v_ops->truncate(dentry, length);
+}
+
 static bool valid_fd(int32_t fd)
 {
     return (fd >= 0 && fd < MAX_FILE_DESCRIPTOR);
@@ -283,13 +382,12 @@ int32_t do_open(char *pathname, int32_t flags)
     file_t *file = vfs_open(pathname, flags);
     if (!file)
         return -1;
-    for (int32_t i = 0; i < MAX_FILE_DESCRIPTOR; ++i) {
-        if (task->fdt[i] == file)
-            return i;  // return exist fd
-    }
+    // every open gets its own file and position
     int32_t fd = get_unused_fd();
-    if (fd == -1)
+    if (fd == -1) {
+        vfs_close(file);
         return -1;
+    }
     task->fdt[fd] = file;
     return fd;
 }
@@ -308,7 +406,7 @@ int32_t do_close(int32_t fd)
 ssize_t do_write(int32_t fd, void *buf, size_t size)
 {
     task_t *task = (task_t *) get_current();
-    if (!valid_fd(fd) || !buf)
+    if (!valid_fd(fd) || !task->fdt[fd] || !buf || !access_ok(buf, size))
         return -1;
     return (ssize_t) vfs_write(task->fdt[fd], (const void *) buf, size);
 }
@@ -316,11 +414,179 @@ ssize_t do_write(int32_t fd, void *buf, size_t size)
 ssize_t do_read(int32_t fd, void *buf, size_t size)
 {
     task_t *task = (task_t *) get_current();
-    if (!valid_fd(fd) || !buf)
+    if (!valid_fd(fd) || !task->fdt[fd] || !buf || !access_ok(buf, size))
         return -1;
     return (ssize_t) vfs_read(task->fdt[fd], buf, size);
 }
 
+ssize_t do_pwrite(int32_t fd, void *buf, size_t size, off_t offset)
+{
+    task_t *task = (task_t *) get_current();
+    if (!valid_fd(fd) || !task->fdt[fd] || !buf || !access_ok(buf, size) ||
+        offset < 0)
+        return -1;
+    return (ssize_t) vfs_pwrite(task->fdt[fd], (const void *) buf, size,
+                                (size_t) offset);
+}
+
+ssize_t do_pread(int32_t fd, void *buf, size_t size, off_t offset)
+{
+    task_t *task = (task_t *) get_current();
+    if (!valid_fd(fd) || !task->fdt[fd] || !buf || !access_ok(buf, size) ||
+        offset < 0)
+        return -1;
+    return (ssize_t) vfs_pread(task->fdt[fd], buf, size, (size_t) offset);
+}
+
+static ssize_t do_iov(int32_t fd,
+                      const struct iovec *iov,
+                      int32_t iovcnt,
+                      bool write)
+{
+    task_t *task = (task_t *) get_current();
+    struct iovec kiov[IOV_MAX];
+    file_t *file;
+    ssize_t total = 0;
+    int ret;
+
+    if (!valid_fd(fd) || !(file = task->fdt[fd]) || !iov || iovcnt < 0 ||
+        iovcnt > IOV_MAX)
+        return -1;
+    // the whole array is validated and copied at once
+    if (copy_from_user(kiov, iov, iovcnt * sizeof(struct iovec)))
+        return -1;
+    iov = kiov;
+    for (int32_t i = 0; i < iovcnt; i++) {
+        if (!access_ok(iov[i].iov_base, iov[i].iov_len)) {
+            return -1;
+        }
+    }
+    for (int32_t i = 0; i < iovcnt; i++) {
+        if (!iov[i].iov_len) {
+            continue;
+        }
+        ret = write ? vfs_write(file, iov[i].iov_base, iov[i].iov_len)
+                    : vfs_read(file, iov[i].iov_base, iov[i].iov_len);
+        if (ret < 0) {
+            return total ? total : -1;
+        }
+        total += ret;
+        if ((size_t) ret < iov[i].iov_len) {
+            break;  // end of file or device full
+        }
+    }
+    return total;
+}
+
+ssize_t do_readv(int32_t fd, const struct iovec *iov, int32_t iovcnt)
+{
+    return do_iov(fd, iov, iovcnt, false);
+}
+
+ssize_t do_writev(int32_t fd, const struct iovec *iov, int32_t iovcnt)
+{
+    return do_iov(fd, iov, iovcnt, true);
+}
+
+/* use and update *offset if given, otherwise the position of `in_fd` */
+ssize_t do_sendfile(int32_t out_fd, int32_t in_fd, off_t *offset, size_t count)
+{
+    task_t *task = (task_t *) get_current();
+    file_t *in, *out;
+    off_t koffset;
+    size_t pos;
+    ssize_t ret;
+
+    if (!valid_fd(out_fd) || !(out = task->fdt[out_fd]) || !valid_fd(in_fd) ||
+        !(in = task->fdt[in_fd]))
+        return -1;
+    if (!offset) {
+        return vfs_sendfile(out, in, &in->f_pos, count);
+    }
+    if (copy_from_user(&koffset, offset, sizeof(koffset)) || koffset < 0)
+        return -1;
+    pos = (size_t) koffset;
+    ret = vfs_sendfile(out, in, &pos, count);
+    koffset = (off_t) pos;
+    if (copy_to_user(offset, &koffset, sizeof(koffset)))
+        return -1;
+    return ret;
+}
+
+off_t do_lseek(int32_t fd, off_t offset, int32_t whence)
+{
+    task_t *task = (task_t *) get_current();
+    if (!valid_fd(fd) || !task->fdt[fd])
+        return -1;
+    return vfs_lseek(task->fdt[fd], offset, whence);
+}
+
+static void sync_filesystems()
+{
+    struct filesystem *fs;
+    list_for_each_entry(fs, &filesystem_list, head)
+    {
+        if (fs->sb && fs->sb->s_op && fs->sb->s_op->sync_fs) {
+            fs->sb->s_op->sync_fs(fs->sb);
+        }
+    }
+}
+
+/* the SD card is the only block device, all dirty blocks belong to it */
+int32_t do_sync()
+{
+    sync_filesystems();
+    return sync_blockdev();
+}
+
+/* dirty blocks are not tracked per file, flush the whole device instead */
+int32_t do_fsync(int32_t fd)
+{
+    task_t *task = (task_t *) get_current();
+    if (!valid_fd(fd) || !task->fdt[fd])
+        return -1;
+    if (task->fdt[fd]->dentry->inode->i_mapping &&
+        filemap_fdatawrite(task->fdt[fd]->dentry->inode->i_mapping))
+        return -E_IO;
+    sync_filesystems();
+    return sync_blockdev();
+}
+
+int32_t do_truncate(char *pathname, size_t length)
+{
+    dentry_t *dentry;
+    char last_component_name[256];
+
+    if (!pathname ||
+        find_dentry(pathname, &dentry, last_component_name) != FILE_FOUND)
+        return -1;
+    return vfs_truncate(dentry, length);
+}
+
+int32_t do_ftruncate(int32_t fd, size_t length)
+{
+    task_t *task = (task_t *) get_current();
+    if (!valid_fd(fd) || !task->fdt[fd])
+        return -1;
+    return vfs_truncate(task->fdt[fd]->dentry, length);
+}
+
+int32_t do_statfs(char *pathname, struct statfs *buf)
+{
+    dentry_t *dentry;
+    char last_component_name[256];
+
+    if (!pathname || !buf ||
+        find_dentry(pathname, &dentry, last_component_name) != FILE_FOUND)
+        return -1;
+    while (dentry->d_mount) {
+        dentry = dentry->d_mount;  // root of the filesystem mounted here
+    }
+    if (!dentry->d_sb || !dentry->d_sb->s_op || !dentry->d_sb->s_op->statfs)
+        return -1;
+    return dentry->d_sb->s_op->statfs(dentry->d_sb, buf);
+}
+
 int32_t do_mkdir(char *pathname)
 {
     return vfs_mkdir(pathname);
@@ -339,12 +605,12 @@ int32_t do_getcwd(char *pathname, size_t size)
 void vfs_test()
 {
     file_t *file;
-    uint8_t buf[64], testdata[64];  // assume max file size in tmpfs = 64 bytes
+    static uint8_t buf[2 * PAGE_SIZE], testdata[2 * PAGE_SIZE];
     size_t count;
     dir_t *dir;
     dentry_t *entry;
 
-    for (int i = 0; i < 64; i++)
+    for (int i = 0; i < 2 * PAGE_SIZE; i++)
         testdata[i] = i;
 
     KERNEL_LOG_INFO("<-- VFS API Test Start -->");
@@ -379,18 +645,42 @@ void vfs_test()
     assert(file != NULL);
     count = vfs_write(file, testdata, 32);
     assert(count == 32);
-    count = vfs_write(file, testdata + 32, 32);
-    assert(count == 32);
-    count = vfs_write(file, testdata + 64, 32);
-    assert(count == 0);  // full
+    count = vfs_write(file, testdata + 32, 2 * PAGE_SIZE - 32);
+    assert(count == 2 * PAGE_SIZE - 32);  // crosses a page boundary
     vfs_close(file);
 
     KERNEL_LOG_INFO("==> Read from file: /file.txt");
     file = vfs_open("/file.txt", 0);
     assert(file != NULL);
-    count = vfs_read(file, buf, 128);
-    assert(count == 64);
+    count = vfs_read(file, buf, sizeof(buf) + 128);
+    assert(count == 2 * PAGE_SIZE);
+    assert(0 == memcmp(testdata, buf, 2 * PAGE_SIZE));
+    vfs_close(file);
+
+    KERNEL_LOG_INFO("==> Truncate and extend file: /file.txt");
+    file = vfs_open("/file.txt", 0);
+    assert(file != NULL);
+    assert(0 == vfs_truncate(file->dentry, 64));
+    assert(0 == vfs_truncate(file->dentry, PAGE_SIZE));
+    count = vfs_read(file, buf, sizeof(buf));
+    assert(count == PAGE_SIZE);
     assert(0 == memcmp(testdata, buf, 64));
+    for (int i = 64; i < PAGE_SIZE; i++)
+        assert(buf[i] == 0);  // the truncated bytes read as zeros
+    vfs_close(file);
+
+    KERNEL_LOG_INFO("==> Write past the end of file: /file.txt");
+    file = vfs_open("/file.txt", 0);
+    assert(file != NULL);
+    file->f_pos = 16 * PAGE_SIZE;
+    count = vfs_write(file, testdata, 32);
+    assert(count == 32);
+    file->f_pos = 8 * PAGE_SIZE;
+    count = vfs_read(file, buf, 32);
+    assert(count == 32);
+    for (int i = 0; i < 32; i++)
+        assert(buf[i] == 0);  // hole
+    assert(0 == vfs_truncate(file->dentry, 0));
     vfs_close(file);
 
     KERNEL_LOG_INFO("==> mkdir: /folder, /file.txt");
@@ -497,3 +787,53 @@ void vfs_test()
 
     KERNEL_LOG_INFO("<-- VFS API Test End -->");
 }
+
+/*
+ * Read a whole file twice and report the throughput. The first pass starts
+ * with the clean pages of the file evicted (cold), the second one is served
+ * from the page cache (warm). A file whose page cache is its only copy, like
+ * one of tmpfs, has no cold pass. Return 0, or -1 if the file cannot be read.
+ */
+int32_t vfs_read_bench(const char *pathname)
+{
+    struct TimeStamp begin, end;
+    file_t *file = vfs_open(pathname, 0);
+    char *buf;
+
+    if (!file || !(buf = kmalloc(PAGE_SIZE))) {
+        vfs_close(file);
+        return -1;
+    }
+
+    struct address_space *mapping = file->dentry->inode->i_mapping;
+    int pass = 0;
+    if (mapping && !mapping->a_ops->writepage) {
+        pass = 1;
+    } else if (mapping) {
+        // pages dirtied through a shared mapping are written back first
+        filemap_fdatawrite(mapping);
+        invalidate_mapping_pages(mapping);
+    }
+
+    for (; pass < 2; pass++) {
+        size_t total = 0;
+        ssize_t count;
+
+        file->f_pos = 0;
+        memset(&file->f_ra, 0, sizeof(file->f_ra));
+        do_get_timestamp(&begin);
+        while ((count = vfs_read(file, buf, PAGE_SIZE)) > 0) {
+            total += count;
+        }
+        do_get_timestamp(&end);
+
+        float sec = (float) (end.counts - begin.counts) / end.freq;
+        printk("%s read: %d bytes in %f s (%f MB/s)\n",
+               pass ? "warm" : "cold", total, sec,
+               sec > 0 ? (float) total / sec / (1 << 20) : 0.0f);
+    }
+
+    kfree(buf);
+    vfs_close(file);
+    return 0;
+}
@@ -0,0 +1,352 @@
+#include <include/vmatree.h>
+#include <include/error.h>
+#include <include/mm.h>
+#include <include/types.h>
+
+/*
+ * VMAs of an address space, kept in an AVL tree ordered by vm_start and
+ * linked into a list in the same order. The tree nodes are the VMAs
+ * themselves, nothing is allocated here.
+ *
+ * Each VMA knows the free gap between the previous VMA and itself, and the
+ * largest such gap of its subtree, so a free range of a given size is found
+ * without visiting subtrees whose gaps are all too small. Lookups first check
+ * the VMA found last, a run of faults in the same VMA skips the tree.
+ */
+
+static inline int32_t height(struct vm_area_struct *vma)
+{
+    return vma ? vma->vm_height : 0;
+}
+
+static inline uint64_t max_gap(struct vm_area_struct *vma)
+{
+    return vma ? vma->vm_max_gap : 0;
+}
+
+/* end of the VMA before `vma`, or the bottom of the tree */
+static virtaddr_t prev_end(struct vma_tree *tree, struct vm_area_struct *vma)
+{
+    if (vma->vm_list.prev == &tree->vma_list) {
+        return tree->min;
+    }
+    return list_entry(vma->vm_list.prev, struct vm_area_struct, vm_list)
+        ->vm_end;
+}
+
+static void update(struct vm_area_struct *vma)
+{
+    vma->vm_height = 1 + MAX(height(vma->vm_left), height(vma->vm_right));
+    vma->vm_max_gap =
+        MAX(vma->vm_gap, MAX(max_gap(vma->vm_left), max_gap(vma->vm_right)));
+}
+
+static void replace_child(struct vma_tree *tree,
+                          struct vm_area_struct *parent,
+                          struct vm_area_struct *old,
+                          struct vm_area_struct *new)
+{
+    if (!parent) {
+        tree->root = new;
+    } else if (parent->vm_left == old) {
+        parent->vm_left = new;
+    } else {
+        parent->vm_right = new;
+    }
+}
+
+/* return the new root of the subtree */
+static struct vm_area_struct *rotate_left(struct vma_tree *tree,
+                                          struct vm_area_struct *x)
+{
+    struct vm_area_struct *y = x->vm_right;
+
+    x->vm_right = y->vm_left;
+    if (y->vm_left) {
+        y->vm_left->vm_parent = x;
+    }
+    y->vm_parent = x->vm_parent;
+    replace_child(tree, x->vm_parent, x, y);
+    y->vm_left = x;
+    x->vm_parent = y;
+    update(x);
+    update(y);
+    return y;
+}
+
+static struct vm_area_struct *rotate_right(struct vma_tree *tree,
+                                           struct vm_area_struct *x)
+{
+    struct vm_area_struct *y = x->vm_left;
+
+    x->vm_left = y->vm_right;
+    if (y->vm_right) {
+        y->vm_right->vm_parent = x;
+    }
+    y->vm_parent = x->vm_parent;
+    replace_child(tree, x->vm_parent, x, y);
+    y->vm_right = x;
+    x->vm_parent = y;
+    update(x);
+    update(y);
+    return y;
+}
+
+/* update `vma` and its ancestors, rotating where they lean too much */
+static void rebalance(struct vma_tree *tree, struct vm_area_struct *vma)
+{
+    struct vm_area_struct *l, *r;
+
+    while (vma) {
+        update(vma);
+        l = vma->vm_left;
+        r = vma->vm_right;
+        if (height(l) > height(r) + 1) {
+            if (height(l->vm_left) < height(l->vm_right)) {
+                rotate_left(tree, l);
+            }
+            vma = rotate_right(tree, vma);
+        } else if (height(r) > height(l) + 1) {
+            if (height(r->vm_right) < height(r->vm_left)) {
+                rotate_right(tree, r);
+            }
+            vma = rotate_left(tree, vma);
+        }
+        vma = vma->vm_parent;
+    }
+}
+
+/* recompute the gap before `vma`, which depends on the VMA before it */
+static void update_gap(struct vma_tree *tree, struct vm_area_struct *vma)
+{
+    if (vma) {
+        vma->vm_gap = vma->vm_start - prev_end(tree, vma);
+        rebalance(tree, vma);
+    }
+}
+
+void vt_init(struct vma_tree *tree, virtaddr_t min, virtaddr_t max)
+{
+    tree->root = NULL;
+    INIT_LIST_HEAD(&tree->vma_list);
+    tree->min = min;
+    tree->max = max;
+    tree->cache = NULL;
+    tree->nr_vmas = 0;
+}
+
+/* free every VMA of the tree */
+void vt_destroy(struct vma_tree *tree)
+{
+    struct vm_area_struct *vma, *tmp;
+
+    list_for_each_entry_safe(vma, tmp, &tree->vma_list, vm_list)
+    {
+        list_del(&vma->vm_list);
+        vma_free(vma);
+    }
+    vt_init(tree, tree->min, tree->max);
+}
+
+/* return the VMA containing `addr`, or NULL */
+struct vm_area_struct *vt_find(struct vma_tree *tree, virtaddr_t addr)
+{
+    struct vm_area_struct *vma = tree->cache;
+
+    if (vma && vma->vm_start <= addr && addr < vma->vm_end) {
+        return vma;
+    }
+    for (vma = tree->root; vma;) {
+        if (addr < vma->vm_start) {
+            vma = vma->vm_left;
+        } else if (addr >= vma->vm_end) {
+            vma = vma->vm_right;
+        } else {
+            tree->cache = vma;
+            return vma;
+        }
+    }
+    return NULL;
+}
+
+/* return the lowest VMA ending above `addr`, or NULL */
+struct vm_area_struct *vt_find_above(struct vma_tree *tree, virtaddr_t addr)
+{
+    struct vm_area_struct *vma = tree->root, *found = NULL;
+
+    while (vma) {
+        if (addr < vma->vm_end) {
+            found = vma;
+            if (addr >= vma->vm_start) {
+                break;
+            }
+            vma = vma->vm_left;
+        } else {
+            vma = vma->vm_right;
+        }
+    }
+    return found;
+}
+
+/* return the VMA after `vma`, or NULL */
+struct vm_area_struct *vt_next(struct vma_tree *tree,
+                               struct vm_area_struct *vma)
+{
+    if (list_is_last(&vma->vm_list, &tree->vma_list)) {
+        return NULL;
+    }
+    return list_entry(vma->vm_list.next, struct vm_area_struct, vm_list);
+}
+
+/* lowest gap of the subtree starting at or above `min` that fits `size` */
+static bool find_gap(struct vma_tree *tree,
+                     struct vm_area_struct *vma,
+                     virtaddr_t min,
+                     virtaddr_t max,
+                     size_t size,
+                     virtaddr_t *start)
+{
+    virtaddr_t gap_start;
+
+    if (!vma || vma->vm_max_gap < size) {
+        return false;
+    }
+    // gaps on the left end before vm_start
+    if (vma->vm_start > min &&
+        find_gap(tree, vma->vm_left, min, max, size, start)) {
+        return true;
+    }
+    gap_start = MAX(prev_end(tree, vma), min);
+    if (gap_start >= max) {
+        return false;
+    }
+    if (gap_start + size <= vma->vm_start && gap_start + size <= max) {
+        *start = gap_start;
+        return true;
+    }
+    return find_gap(tree, vma->vm_right, min, max, size, start);
+}
+
+/* find the lowest free range of `size` bytes in [min, max) */
+int32_t vt_find_gap(struct vma_tree *tree,
+                    virtaddr_t min,
+                    virtaddr_t max,
+                    size_t size,
+                    virtaddr_t *start)
+{
+    struct vm_area_struct *last;
+    virtaddr_t gap_start;
+
+    min = MAX(min, tree->min);
+    max = MIN(max, tree->max);
+    if (!size || min >= max || max - min < size) {
+        return -E_NO_MEM;
+    }
+    if (find_gap(tree, tree->root, min, max, size, start)) {
+        return 0;
+    }
+
+    // the gap above the last VMA is not in the tree
+    gap_start = min;
+    if (!list_empty(&tree->vma_list)) {
+        last = list_entry(tree->vma_list.prev, struct vm_area_struct, vm_list);
+        gap_start = MAX(last->vm_end, min);
+    }
+    if (gap_start < max && max - gap_start >= size) {
+        *start = gap_start;
+        return 0;
+    }
+    return -E_NO_MEM;
+}
+
+/* insert `vma`, which must not overlap another VMA of the tree */
+int32_t vt_insert(struct vma_tree *tree, struct vm_area_struct *vma)
+{
+    struct vm_area_struct **link = &tree->root, *parent = NULL, *prev = NULL,
+                          *next;
+
+    if (vma->vm_start >= vma->vm_end || vma->vm_start < tree->min ||
+        vma->vm_end > tree->max) {
+        return -E_INVAL;
+    }
+    while (*link) {
+        parent = *link;
+        if (vma->vm_start < parent->vm_start) {
+            link = &parent->vm_left;
+        } else {
+            prev = parent;
+            link = &parent->vm_right;
+        }
+    }
+    next = prev ? vt_next(tree, prev)
+           : list_empty(&tree->vma_list)
+               ? NULL
+               : list_first_entry(&tree->vma_list, struct vm_area_struct,
+                                  vm_list);
+    if ((prev && prev->vm_end > vma->vm_start) ||
+        (next && vma->vm_end > next->vm_start)) {
+        return -E_BUSY;
+    }
+
+    *link = vma;
+    vma->vm_parent = parent;
+    vma->vm_left = vma->vm_right = NULL;
+    list_add(&vma->vm_list, prev ? &prev->vm_list : &tree->vma_list);
+    tree->nr_vmas++;
+
+    update_gap(tree, vma);
+    update_gap(tree, next);
+    return 0;
+}
+
+/* remove `vma` from the tree, the caller frees it */
+void vt_erase(struct vma_tree *tree, struct vm_area_struct *vma)
+{
+    struct vm_area_struct *next = vt_next(tree, vma), *parent = vma->vm_parent,
+                          *child, *succ, *from;
+
+    if (vma->vm_left && vma->vm_right) {
+        // the leftmost VMA of the right subtree takes the place of `vma`
+        succ = vma->vm_right;
+        while (succ->vm_left) {
+            succ = succ->vm_left;
+        }
+        if (succ->vm_parent == vma) {
+            from = succ;
+        } else {
+            from = succ->vm_parent;
+            from->vm_left = succ->vm_right;
+            if (succ->vm_right) {
+                succ->vm_right->vm_parent = from;
+            }
+            succ->vm_right = vma->vm_right;
+            vma->vm_right->vm_parent = succ;
+        }
+        succ->vm_left = vma->vm_left;
+        vma->vm_left->vm_parent = succ;
+        succ->vm_parent = parent;
+        replace_child(tree, parent, vma, succ);
+    } else {
+        child = vma->vm_left ? vma->vm_left : vma->vm_right;
+        if (child) {
+            child->vm_parent = parent;
+        }
+        replace_child(tree, parent, vma, child);
+        from = parent;
+    }
+
+    list_del(&vma->vm_list);
+    tree->nr_vmas--;
+    if (tree->cache == vma) {
+        tree->cache = NULL;
+    }
+    rebalance(tree, from);
+    update_gap(tree, next);
+}
+
+/* the range of `vma` changed without passing another VMA, fix the gaps */
+void vt_update(struct vma_tree *tree, struct vm_area_struct *vma)
+{
+    update_gap(tree, vma);
+    update_gap(tree, vt_next(tree, vma));
+}
@@ -0,0 +1,203 @@
+#include <include/mman.h>
+#include <include/stdlib.h>
+#include <include/string.h>
+#include <include/syscall.h>
+#include <include/types.h>
+
+/*
+ * User space allocator. Small blocks come from per size class free lists,
+ * refilled by carving chunks taken from the heap with sbrk(). A block larger
+ * than the biggest class gets its own anonymous mapping, returned to the
+ * kernel by free().
+ *
+ * Every block starts with a header holding its size, so free() finds its
+ * class without a lookup. Each list has its own spin lock, the heap has
+ * another one for sbrk().
+ */
+
+#define MALLOC_ALIGN 16
+#define MALLOC_MIN_SHIFT 4                  /* smallest class, 16 bytes */
+#define MALLOC_NR_CLASSES 8                 /* classes up to 2KB */
+#define MALLOC_MAX_SMALL (MALLOC_ALIGN << (MALLOC_NR_CLASSES - 1))
+#define MALLOC_CHUNK_SIZE (4 * PAGE_SIZE)  /* heap taken per refill */
+
+struct malloc_hdr {
+    size_t size;  // bytes of the block, header included
+    size_t pad;   // keeps the payload 16 bytes aligned
+};
+
+struct free_block {
+    struct free_block *next;
+};
+
+struct size_class {
+    uint32_t lock;
+    struct free_block *free_list;
+};
+
+static struct size_class classes[MALLOC_NR_CLASSES];
+static uint32_t heap_lock;
+static char *cur_brk;
+
+static void spin_lock(uint32_t *lock)
+{
+    uint32_t busy, fail;
+
+    asm volatile(
+        "1: ldaxr %w0, [%2]\n"
+        "   cbnz %w0, 1b\n"
+        "   stxr %w1, %w3, [%2]\n"
+        "   cbnz %w1, 1b"
+        : "=&r"(busy), "=&r"(fail)
+        : "r"(lock), "r"(1)
+        : "memory");
+}
+
+static void spin_unlock(uint32_t *lock)
+{
+    asm volatile("stlr wzr, [%0]" ::"r"(lock) : "memory");
+}
+
+/* grow the heap by `increment` bytes and return its previous end */
+void *sbrk(intptr_t increment)
+{
+    char *old, *new;
+
+    spin_lock(&heap_lock);
+    if (!cur_brk) {
+        cur_brk = brk(NULL);
+    }
+    old = cur_brk;
+    if (increment && (new = brk(old + increment)) != old + increment) {
+        spin_unlock(&heap_lock);
+        return (void *) -1;
+    }
+    cur_brk = old + increment;
+    spin_unlock(&heap_lock);
+    return old;
+}
+
+/* index of the smallest class holding `size` bytes */
+static int size_to_class(size_t size)
+{
+    int idx = 0;
+
+    while ((size_t) MALLOC_ALIGN << idx < size) {
+        idx++;
+    }
+    return idx;
+}
+
+/* carve a new heap chunk into blocks of class `idx`, lock must be held */
+static bool refill_class(int idx)
+{
+    struct size_class *sc = &classes[idx];
+    size_t size = (size_t) MALLOC_ALIGN << idx;
+    char *chunk = sbrk(MALLOC_CHUNK_SIZE);
+    struct free_block *block;
+
+    if (chunk == (void *) -1) {
+        return false;
+    }
+    for (size_t off = 0; off + size <= MALLOC_CHUNK_SIZE; off += size) {
+        block = (struct free_block *) (chunk + off);
+        block->next = sc->free_list;
+        sc->free_list = block;
+    }
+    return true;
+}
+
+void *malloc(size_t size)
+{
+    struct malloc_hdr *hdr;
+    struct size_class *sc;
+    size_t total = size + sizeof(struct malloc_hdr);
+    int idx;
+
+    // the header and the rounding to pages must not wrap around
+    if (!size || size > (size_t) -1 - sizeof(struct malloc_hdr) - PAGE_SIZE) {
+        return NULL;
+    }
+
+    if (total > MALLOC_MAX_SMALL) {
+        total = ROUNDUP(total, PAGE_SIZE);
+        hdr = mmap(NULL, total, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (hdr == MAP_FAILED) {
+            return NULL;
+        }
+        hdr->size = total;
+        return hdr + 1;
+    }
+
+    idx = size_to_class(total);
+    sc = &classes[idx];
+    spin_lock(&sc->lock);
+    if (!sc->free_list && !refill_class(idx)) {
+        spin_unlock(&sc->lock);
+        return NULL;
+    }
+    hdr = (struct malloc_hdr *) sc->free_list;
+    sc->free_list = sc->free_list->next;
+    spin_unlock(&sc->lock);
+
+    hdr->size = (size_t) MALLOC_ALIGN << idx;
+    return hdr + 1;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if (size && nmemb > (size_t) -1 / size) {
+        return NULL;
+    }
+    if ((ptr = malloc(nmemb * size))) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    struct malloc_hdr *hdr;
+    size_t old;
+    void *new;
+
+    if (!ptr) {
+        return malloc(size);
+    }
+    hdr = (struct malloc_hdr *) ptr - 1;
+    old = hdr->size - sizeof(struct malloc_hdr);
+    if (size <= old) {
+        return ptr;
+    }
+    if ((new = malloc(size))) {
+        memcpy(new, ptr, old);
+        free(ptr);
+    }
+    return new;
+}
+
+void free(void *ptr)
+{
+    struct malloc_hdr *hdr;
+    struct free_block *block;
+    struct size_class *sc;
+
+    if (!ptr) {
+        return;
+    }
+    hdr = (struct malloc_hdr *) ptr - 1;
+    if (hdr->size > MALLOC_MAX_SMALL) {
+        munmap(hdr, hdr->size);
+        return;
+    }
+
+    sc = &classes[size_to_class(hdr->size)];
+    block = (struct free_block *) hdr;
+    spin_lock(&sc->lock);
+    block->next = sc->free_list;
+    sc->free_list = block;
+    spin_unlock(&sc->lock);
+}
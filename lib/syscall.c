@@ -1,6 +1,7 @@
 #include <include/syscall.h>
 #include <include/task.h>
 #include <include/types.h>
+#include <include/vdso.h>
 
 #define ASM_ARGS_0
 #define ASM_ARGS_1 , "r"(_x0)
@@ -112,15 +113,13 @@
 
 SYSCALL_ARG1(reset, int64_t, uint64_t)
 SYSCALL_ARG0(cancel_reset, int64_t)
-SYSCALL_ARG1(get_timestamp, int64_t, struct TimeStamp *)
 SYSCALL_ARG2(uart_read, int64_t, void *, size_t)
 SYSCALL_ARG2(uart_write, int64_t, void *, size_t)
-SYSCALL_ARG0(get_taskid, uint32_t)
 SYSCALL_ARG1(exec, int64_t, void *);
 SYSCALL_ARG0(fork, int64_t)
 SYSCALL_ARG0(exit, int64_t)
 SYSCALL_ARG2(kill, int32_t, pid_t, int32_t)
-SYSCALL_ARG6(mmap, void *, void *, size_t, int32_t, int32_t, void *, int32_t)
+SYSCALL_ARG6(mmap, void *, void *, size_t, int32_t, int32_t, int32_t, off_t)
 SYSCALL_ARG2(open, int32_t, char *, int32_t)
 SYSCALL_ARG1(close, int32_t, int32_t)
 SYSCALL_ARG3(read, ssize_t, int32_t, void *, size_t)
@@ -131,4 +130,62 @@ SYSCALL_ARG2(getcwd, int32_t, char *, size_t)
 SYSCALL_ARG3(mount, int32_t, char *, char *, char *)
 SYSCALL_ARG2(opendir, int32_t, char *, dir_t **)
 SYSCALL_ARG4(readdir, int32_t, dir_t *, char *, enum node_attr_flag *, size_t *)
-SYSCALL_ARG1(closedir, int32_t, dir_t *)
\ No newline at end of file
+SYSCALL_ARG1(closedir, int32_t, dir_t *)
+SYSCALL_ARG0(sync, int32_t)
+SYSCALL_ARG1(fsync, int32_t, int32_t)
+SYSCALL_ARG1(iostat, int32_t, struct blk_stats *)
+SYSCALL_ARG2(io_submit, int32_t, struct iocb *, int32_t)
+SYSCALL_ARG3(io_getevents, int32_t, int32_t, int32_t, struct io_event *)
+SYSCALL_ARG2(truncate, int32_t, char *, size_t)
+SYSCALL_ARG2(ftruncate, int32_t, int32_t, size_t)
+SYSCALL_ARG2(statfs, int32_t, char *, struct statfs *)
+SYSCALL_ARG3(lseek, off_t, int32_t, off_t, int32_t)
+SYSCALL_ARG4(pread, ssize_t, int32_t, void *, size_t, off_t)
+SYSCALL_ARG4(pwrite, ssize_t, int32_t, void *, size_t, off_t)
+SYSCALL_ARG3(readv, ssize_t, int32_t, const struct iovec *, int32_t)
+SYSCALL_ARG3(writev, ssize_t, int32_t, const struct iovec *, int32_t)
+SYSCALL_ARG4(sendfile, ssize_t, int32_t, int32_t, off_t *, size_t)
+SYSCALL_ARG3(msync, int32_t, void *, size_t, int32_t)
+SYSCALL_ARG2(munmap, int32_t, void *, size_t)
+SYSCALL_ARG3(mprotect, int32_t, void *, size_t, int32_t)
+SYSCALL_ARG1(brk, void *, void *)
+SYSCALL_ARG0(spawn, int64_t)
+SYSCALL_ARG3(madvise, int32_t, void *, size_t, int32_t)
+SYSCALL_ARG3(execve, int64_t, const char *, char *const *, char *const *)
+SYSCALL_ARG1(io_uring_setup, struct io_uring *, uint32_t)
+SYSCALL_ARG1(io_uring_enter, int32_t, uint32_t)
+SYSCALL_ARG3(sigaction,
+             int32_t,
+             int32_t,
+             const struct sigaction *,
+             struct sigaction *)
+SYSCALL_ARG3(sigprocmask, int32_t, int32_t, const sigvec_t *, sigvec_t *)
+SYSCALL_ARG3(sigqueue, int32_t, pid_t, int32_t, uint64_t)
+SYSCALL_ARG1(readbench, int32_t, char *)
+
+/* the timestamp and the task id are read by the vDSO, without a trap */
+int64_t get_timestamp(struct TimeStamp *ts)
+{
+    return ((int64_t(*)(struct TimeStamp *)) VDSO_GET_TIMESTAMP)(ts);
+}
+
+uint32_t get_taskid()
+{
+    return ((uint32_t(*)()) VDSO_GET_TASKID)();
+}
+
+int64_t get_timestamp_syscall(struct TimeStamp *ts)
+{
+    return (int64_t) INTERNAL_SYSCALL(get_timestamp, 1, ts);
+}
+
+/* install `handler` for `sig` and return the previous one */
+sig_t signal(int32_t sig, sig_t handler)
+{
+    struct sigaction act = {.sa_handler = handler}, old;
+
+    if (sigaction(sig, &act, &old) == -1) {
+        return SIG_ERR;
+    }
+    return old.sa_handler;
+}
@@ -1,7 +1,57 @@
 #include "user/ulib.h"
+#include <include/console.h>
 
 #define filetype(flag) (flag == DIRECTORY ? 'D' : 'F')
 #define BUFFER_MAX_SIZE 256
+#define AIO_DEMO_NR 4
+#define COPY_CHUNK_SIZE (1 << 16)
+#define AIO_DEMO_SIZE 4096
+#define MALLOC_BENCH_NR 256
+#define VMA_BENCH_NR 2048
+#define FORK_BENCH_PAGES 64
+#define SPAWN_BENCH_NR 8
+#define SPAWN_BENCH_PAGES 512
+#define THP_BENCH_SIZE (64 << 20)
+#define THP_BENCH_ACCESSES (1 << 20)
+#define RUN_MAX_ARGS 16
+#define VDSO_BENCH_NR 10000
+#define URING_BENCH_NR 256
+#define URING_BENCH_BATCH 16  // files per io_uring_enter, 3 sqes each
+#define URING_BENCH_SIZE 512
+#define SIGDEMO_RT_NR 3
+
+static char **environ;
+static struct io_uring *uring;
+static volatile int sigdemo_caught;
+
+/* handler of sigdemo, runs on the user stack and returns by sigreturn */
+static void sigdemo_handler(int32_t sig, siginfo_t *info, void *ctx)
+{
+    printf("caught signal %d from %d, value %d\n", sig, info->si_pid,
+           (int) info->si_value);
+    sigdemo_caught++;
+}
+
+/* queue one sqe, the caller makes sure the submission ring has room */
+static void uring_queue(uint8_t opcode,
+                        uint8_t flags,
+                        uint64_t addr,
+                        uint32_t len)
+{
+    struct io_uring_sqe *sqe =
+        &uring->sqes[uring->sq_tail & (uring->entries - 1)];
+
+    sqe->opcode = opcode;
+    sqe->flags = flags;
+    sqe->fd = -1;
+    sqe->len = len;
+    sqe->off = -1;
+    sqe->addr = addr;
+    sqe->user_data = opcode;
+    // the sqe must be written before the kernel can see it
+    __sync_synchronize();
+    uring->sq_tail++;
+}
 
 int search_command(char *str)
 {
@@ -22,6 +72,23 @@ int search_command(char *str)
             "pwd: show working directory\n"
             "cd: change working directory\n"
             "cat: dump file content\n"
+            "tail: dump the last bytes of a file\n"
+            "cp: copy a file\n"
+            "wc: count lines and bytes of a mapped file\n"
+            "sync: write cached blocks back to the SD card\n"
+            "iostat: show SD card request statistics\n"
+            "aio: read a file with several asynchronous requests in flight\n"
+            "df: show space usage of the filesystem of a path\n"
+            "mallocbench: time malloc against one mmap per allocation\n"
+            "vmabench: time mmap, faults and munmap of many mappings\n"
+            "forkbench: time fork and writes to copy-on-write pages\n"
+            "spawnbench: time fork of a large task against spawn\n"
+            "thpbench: time random accesses with and without huge pages\n"
+            "run: execute an ELF file with arguments in a new task\n"
+            "vdsobench: time get_timestamp by the vDSO against a syscall\n"
+            "uringbench: time small file reads by syscalls and by a ring\n"
+            "readbench: time cold and warm page cache reads of a file\n"
+            "sigdemo: catch, block and queue signals sent to the shell\n"
             "reboot: reboot rpi3 (not work on QEMU)\n"
             "exit: exit shell\n");
     } else if (!strcmp(str, "timestamp")) {
@@ -50,8 +117,15 @@ int search_command(char *str)
     } else if (!strncmp(str, "cd ", 3)) {
         chdir(&str[3]);
     } else if (!strncmp(str, "cat ", 4)) {
+        int out;
         if ((fd = open(&str[4], 0)) == -1) {
             printf("file not found\n");
+        } else if ((out = open(CONSOLE_PATH, 0)) != -1) {
+            // copied by the kernel from the page cache to the UART
+            while (sendfile(out, fd, NULL, COPY_CHUNK_SIZE) > 0)
+                ;
+            close(out);
+            close(fd);
         } else {
             while ((count = read(fd, buf, sizeof(buf) - 1)) > 0) {
                 buf[count] = 0;
@@ -59,6 +133,388 @@ int search_command(char *str)
             }
             close(fd);
         }
+    } else if (!strncmp(str, "cp ", 3)) {
+        char *dst = &str[3];
+        int out;
+        while (*dst && *dst != ' ')
+            dst++;
+        if (!*dst) {
+            printf("usage: cp <source> <target>\n");
+            return 0;
+        }
+        *dst++ = 0;
+        if ((fd = open(&str[3], 0)) == -1) {
+            printf("file not found\n");
+        } else if ((out = open(dst, O_CREAT)) == -1) {
+            printf("cannot create %s\n", dst);
+            close(fd);
+        } else {
+            while (sendfile(out, fd, NULL, COPY_CHUNK_SIZE) > 0)
+                ;
+            close(out);
+            close(fd);
+        }
+    } else if (!strncmp(str, "tail ", 5)) {
+        off_t end;
+        if ((fd = open(&str[5], 0)) == -1) {
+            printf("file not found\n");
+        } else {
+            end = lseek(fd, 0, SEEK_END);
+            count = pread(fd, buf, sizeof(buf) - 1,
+                          end > (off_t) sizeof(buf) - 1 ? end - sizeof(buf) + 1
+                                                        : 0);
+            if (count > 0) {
+                buf[count] = 0;
+                printf("%s", buf);
+            }
+            close(fd);
+        }
+    } else if (!strncmp(str, "wc ", 3)) {
+        off_t size;
+        char *data;
+        int lines = 0;
+        if ((fd = open(&str[3], 0)) == -1) {
+            printf("file not found\n");
+            return 0;
+        }
+        size = lseek(fd, 0, SEEK_END);
+        data = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                        : MAP_FAILED;
+        if (data != MAP_FAILED) {
+            // pages come straight from the page cache on first touch
+            for (off_t i = 0; i < size; i++) {
+                lines += (data[i] == '\n');
+            }
+            munmap(data, size);
+        }
+        printf("%d lines, %d bytes\n", lines, (int) (size > 0 ? size : 0));
+        close(fd);
+    } else if (!strcmp(str, "sync")) {
+        sync();
+    } else if (!strcmp(str, "iostat")) {
+        struct blk_stats st;
+        const char *op[] = {"read", "write"};
+        iostat(&st);
+        get_timestamp(&ts);
+        printf("op\trequests\tmerges\tsectors\tavg latency(us)\n");
+        for (int i = 0; i < 2; i++) {
+            printf("%s\t%d\t\t%d\t%d\t%f\n", op[i], (int) st.ios[i],
+                   (int) st.merges[i], (int) st.sectors[i],
+                   st.ios[i] ? (float) st.ticks[i] * 1000000 / ts.freq /
+                                   st.ios[i]
+                             : 0.0);
+        }
+    } else if (!strncmp(str, "aio ", 4)) {
+        static char aio_buf[AIO_DEMO_NR][AIO_DEMO_SIZE];
+        struct iocb cbs[AIO_DEMO_NR];
+        struct io_event events[AIO_DEMO_NR];
+        int nr;
+        if ((fd = open(&str[4], 0)) == -1) {
+            printf("file not found\n");
+            return 0;
+        }
+        for (int i = 0; i < AIO_DEMO_NR; i++) {
+            cbs[i].aio_data = i;
+            cbs[i].aio_fildes = fd;
+            cbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+            cbs[i].aio_buf = aio_buf[i];
+            cbs[i].aio_nbytes = AIO_DEMO_SIZE;
+            cbs[i].aio_offset = i * AIO_DEMO_SIZE;
+        }
+        nr = io_submit(cbs, AIO_DEMO_NR);
+        printf("%d requests in flight\n", nr);
+        if (nr > 0) {
+            nr = io_getevents(nr, nr, events);
+            for (int i = 0; i < nr; i++) {
+                printf("request %d at offset %d: %d bytes\n",
+                       (int) events[i].data,
+                       (int) events[i].data * AIO_DEMO_SIZE,
+                       (int) events[i].res);
+            }
+        }
+        close(fd);
+    } else if (!strncmp(str, "df", 2) && (!str[2] || str[2] == ' ')) {
+        struct statfs st;
+        if (statfs(str[2] ? &str[3] : ".", &st) == -1) {
+            printf("no space information\n");
+        } else {
+            printf("Size(KB)\tUsed(KB)\tAvail(KB)\n");
+            printf("%d\t\t%d\t\t%d\n", (int) (st.f_blocks * st.f_bsize / 1024),
+                   (int) ((st.f_blocks - st.f_bfree) * st.f_bsize / 1024),
+                   (int) (st.f_bfree * st.f_bsize / 1024));
+        }
+    } else if (!strcmp(str, "mallocbench")) {
+        static char *ptrs[MALLOC_BENCH_NR];
+        const size_t sizes[] = {32, 256, 1024};
+        struct TimeStamp t0, t1, t2;
+        printf("size\tmalloc(us)\tmmap(us)\n");
+        for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            // each block is touched once, so both pay for the page fault
+            get_timestamp(&t0);
+            for (int i = 0; i < MALLOC_BENCH_NR; i++) {
+                if ((ptrs[i] = malloc(sizes[s]))) {
+                    ptrs[i][0] = 1;
+                }
+            }
+            for (int i = 0; i < MALLOC_BENCH_NR; i++) {
+                free(ptrs[i]);
+            }
+            get_timestamp(&t1);
+            for (int i = 0; i < MALLOC_BENCH_NR; i++) {
+                ptrs[i] = mmap(NULL, sizes[s], PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (ptrs[i] != MAP_FAILED) {
+                    ptrs[i][0] = 1;
+                    munmap(ptrs[i], sizes[s]);
+                }
+            }
+            get_timestamp(&t2);
+            printf("%d\t%f\t%f\n", (int) sizes[s],
+                   (float) (t1.counts - t0.counts) * 1000000 / t0.freq /
+                       MALLOC_BENCH_NR,
+                   (float) (t2.counts - t1.counts) * 1000000 / t0.freq /
+                       MALLOC_BENCH_NR);
+        }
+    } else if (!strcmp(str, "vmabench")) {
+        static char *maps[VMA_BENCH_NR];
+        struct TimeStamp t0, t1, t2, t3;
+        int nr = 0;
+        get_timestamp(&t0);
+        while (nr < VMA_BENCH_NR) {
+            // alternate protections so that no two mappings are merged
+            maps[nr] = mmap(NULL, PAGE_SIZE,
+                            nr % 2 ? PROT_READ | PROT_WRITE : PROT_READ,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (maps[nr] == MAP_FAILED) {
+                break;
+            }
+            nr++;
+        }
+        get_timestamp(&t1);
+        count = 0;
+        for (int i = 0; i < nr; i++) {
+            count += maps[i][0];  // one fault per mapping
+        }
+        get_timestamp(&t2);
+        for (int i = 0; i < nr; i++) {
+            munmap(maps[i], PAGE_SIZE);
+        }
+        get_timestamp(&t3);
+        printf("%d mappings\n", nr);
+        printf("mmap(us)\tfault(us)\tmunmap(us)\n");
+        printf("%f\t%f\t%f\n",
+               nr ? (float) (t1.counts - t0.counts) * 1000000 / t0.freq / nr
+                  : 0.0,
+               nr ? (float) (t2.counts - t1.counts) * 1000000 / t0.freq / nr
+                  : 0.0,
+               nr ? (float) (t3.counts - t2.counts) * 1000000 / t0.freq / nr
+                  : 0.0);
+    } else if (!strcmp(str, "forkbench")) {
+        struct TimeStamp t0, t1, t2;
+        char *area = mmap(NULL, FORK_BENCH_PAGES * PAGE_SIZE,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (area == MAP_FAILED) {
+            printf("mmap failed\n");
+            return 0;
+        }
+        get_timestamp(&t0);
+        if (fork() == 0) {
+            // pages still shared with the parent are copied
+            for (int i = 0; i < FORK_BENCH_PAGES; i++) {
+                area[i * PAGE_SIZE] = 1;
+            }
+            exit();
+        }
+        get_timestamp(&t1);
+        // pages the child already copied are taken over without a copy
+        for (int i = 0; i < FORK_BENCH_PAGES; i++) {
+            area[i * PAGE_SIZE] = 2;
+        }
+        get_timestamp(&t2);
+        printf("fork(us)\twrite per page(us)\n");
+        printf("%f\t%f\n", (float) (t1.counts - t0.counts) * 1000000 / t0.freq,
+               (float) (t2.counts - t1.counts) * 1000000 / t0.freq /
+                   FORK_BENCH_PAGES);
+        munmap(area, FORK_BENCH_PAGES * PAGE_SIZE);
+    } else if (!strcmp(str, "spawnbench")) {
+        struct TimeStamp t0, t1, t2;
+        char *area = mmap(NULL, SPAWN_BENCH_PAGES * PAGE_SIZE,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (area == MAP_FAILED) {
+            printf("mmap failed\n");
+            return 0;
+        }
+        get_timestamp(&t0);
+        for (int i = 0; i < SPAWN_BENCH_NR; i++) {
+            if (fork() == 0) {
+                exit();
+            }
+        }
+        get_timestamp(&t1);
+        for (int i = 0; i < SPAWN_BENCH_NR; i++) {
+            // the child is killed before it loads another shell
+            int64_t pid = spawn();
+            if (pid >= 0) {
+                kill(pid, SIGKILL);
+            }
+        }
+        get_timestamp(&t2);
+        printf("fork(us)\tspawn(us)\n");
+        printf("%f\t%f\n",
+               (float) (t1.counts - t0.counts) * 1000000 / t0.freq /
+                   SPAWN_BENCH_NR,
+               (float) (t2.counts - t1.counts) * 1000000 / t0.freq /
+                   SPAWN_BENCH_NR);
+        munmap(area, SPAWN_BENCH_PAGES * PAGE_SIZE);
+    } else if (!strcmp(str, "thpbench")) {
+        printf("huge\tfault(ms)\taccess(ns)\n");
+        for (int huge = 1; huge >= 0; huge--) {
+            struct TimeStamp t0, t1, t2;
+            uint32_t x = 1;
+            char *area = mmap(NULL, THP_BENCH_SIZE, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (area == MAP_FAILED) {
+                printf("mmap failed\n");
+                return 0;
+            }
+            if (!huge) {
+                madvise(area, THP_BENCH_SIZE, MADV_NOHUGEPAGE);
+            }
+            get_timestamp(&t0);
+            for (int i = 0; i < THP_BENCH_SIZE; i += PAGE_SIZE) {
+                area[i] = 1;
+            }
+            get_timestamp(&t1);
+            count = 0;
+            for (int i = 0; i < THP_BENCH_ACCESSES; i++) {
+                // each access likely lands on a page missing from the TLB
+                x = x * 1103515245 + 12345;
+                count += area[(x >> 4) % THP_BENCH_SIZE];
+            }
+            get_timestamp(&t2);
+            printf("%d\t%f\t%f\n", huge,
+                   (float) (t1.counts - t0.counts) * 1000 / t0.freq,
+                   (float) (t2.counts - t1.counts) * 1000000000 / t0.freq /
+                       THP_BENCH_ACCESSES);
+            munmap(area, THP_BENCH_SIZE);
+        }
+    } else if (!strncmp(str, "run ", 4)) {
+        char *argv[RUN_MAX_ARGS + 1];
+        int argc = 0;
+        for (char *p = &str[4]; *p && argc < RUN_MAX_ARGS;) {
+            while (*p == ' ')
+                *p++ = 0;
+            if (*p) {
+                argv[argc++] = p;
+            }
+            while (*p && *p != ' ')
+                p++;
+        }
+        argv[argc] = NULL;
+        if (!argc) {
+            printf("usage: run <file> [args...]\n");
+        } else if (fork() == 0) {
+            execve(argv[0], argv, environ);
+            printf("cannot execute %s\n", argv[0]);
+            exit();
+        }
+    } else if (!strcmp(str, "vdsobench")) {
+        struct TimeStamp t0, t1, t2, t3;
+        get_timestamp(&t0);
+        for (int i = 0; i < VDSO_BENCH_NR; i++) {
+            get_timestamp(&ts);
+        }
+        get_timestamp(&t1);
+        for (int i = 0; i < VDSO_BENCH_NR; i++) {
+            get_timestamp_syscall(&ts);
+        }
+        get_timestamp(&t2);
+        for (int i = 0; i < VDSO_BENCH_NR; i++) {
+            get_taskid();
+        }
+        get_timestamp(&t3);
+        printf("vdso(ns)\tsyscall(ns)\ttaskid(ns)\n");
+        printf("%f\t%f\t%f\n",
+               (float) (t1.counts - t0.counts) * 1000000000 / t0.freq /
+                   VDSO_BENCH_NR,
+               (float) (t2.counts - t1.counts) * 1000000000 / t0.freq /
+                   VDSO_BENCH_NR,
+               (float) (t3.counts - t2.counts) * 1000000000 / t0.freq /
+                   VDSO_BENCH_NR);
+    } else if (!strncmp(str, "uringbench ", 11)) {
+        static char rbuf[URING_BENCH_SIZE];
+        char *path = &str[11];
+        struct TimeStamp t0, t1, t2;
+        int errors = 0;
+
+        if (!uring && !(uring = io_uring_setup(URING_MAX_ENTRIES))) {
+            printf("io_uring_setup failed\n");
+            return 0;
+        }
+        get_timestamp(&t0);
+        for (int i = 0; i < URING_BENCH_NR; i++) {
+            if ((fd = open(path, 0)) == -1 ||
+                read(fd, rbuf, URING_BENCH_SIZE) < 0) {
+                errors++;
+            }
+            close(fd);
+        }
+        get_timestamp(&t1);
+        for (int i = 0; i < URING_BENCH_NR; i += URING_BENCH_BATCH) {
+            int n = MIN(URING_BENCH_NR - i, URING_BENCH_BATCH);
+            for (int j = 0; j < n; j++) {
+                uring_queue(IORING_OP_OPEN, 0, (uint64_t) path, 0);
+                uring_queue(IORING_OP_READ, IOSQE_FD_LAST, (uint64_t) rbuf,
+                            URING_BENCH_SIZE);
+                uring_queue(IORING_OP_CLOSE, IOSQE_FD_LAST, 0, 0);
+            }
+            io_uring_enter(3 * n);
+            __sync_synchronize();
+            while (uring->cq_head != uring->cq_tail) {
+                struct io_uring_cqe *cqe =
+                    &uring->cqes[uring->cq_head & (uring->entries - 1)];
+                if (cqe->user_data != IORING_OP_CLOSE && cqe->res < 0) {
+                    errors++;
+                }
+                uring->cq_head++;
+            }
+        }
+        get_timestamp(&t2);
+        printf("syscalls(reads/s)\tring(reads/s)\terrors\n");
+        printf("%f\t%f\t%d\n",
+               (float) URING_BENCH_NR * t0.freq / (t1.counts - t0.counts),
+               (float) URING_BENCH_NR * t0.freq / (t2.counts - t1.counts),
+               errors);
+    } else if (!strncmp(str, "readbench ", 10)) {
+        // the kernel drops the cached pages of the file and reads it twice
+        if (readbench(&str[10]) == -1) {
+            printf("readbench: cannot read %s\n", &str[10]);
+        }
+    } else if (!strcmp(str, "sigdemo")) {
+        struct sigaction act = {.sa_sigaction = sigdemo_handler};
+        sigvec_t set = sigmask(SIGUSR1) | sigmask(SIGRTMIN), old;
+        pid_t self = get_taskid();
+
+        sigdemo_caught = 0;
+        sigaction(SIGUSR1, &act, NULL);
+        sigaction(SIGRTMIN, &act, NULL);
+        // caught on the return of kill
+        kill(self, SIGUSR1);
+        sigprocmask(SIG_BLOCK, &set, &old);
+        // a standard signal is pending once, realtime ones are queued
+        kill(self, SIGUSR1);
+        kill(self, SIGUSR1);
+        for (int i = 1; i <= SIGDEMO_RT_NR; i++) {
+            sigqueue(self, SIGRTMIN, i);
+        }
+        printf("%d caught while blocked\n", sigdemo_caught);
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        printf("%d caught once unblocked, %d expected\n", sigdemo_caught,
+               2 + SIGDEMO_RT_NR);
+        signal(SIGUSR1, SIG_DFL);
+        signal(SIGRTMIN, SIG_DFL);
     } else if (!strcmp(str, "test")) {
         fd = open("/a.txt", O_CREAT);
         int sz = write(fd, "Hello world", 11);
@@ -70,9 +526,20 @@ int search_command(char *str)
     return 0;
 }
 
-int main()
+/* run each argument as a command if any, otherwise read commands */
+int main(int argc, char *argv[], char *envp[])
 {
     char str[BUFFER_MAX_SIZE];
+
+    environ = envp;
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            strncpy(str, argv[i], BUFFER_MAX_SIZE - 1);
+            str[BUFFER_MAX_SIZE - 1] = 0;
+            search_command(str);
+        }
+        return 0;
+    }
     printf("\n---Raspberry PI 3 B+---\n");
     printf("~$ ");
     while (fgets(str, BUFFER_MAX_SIZE)) {